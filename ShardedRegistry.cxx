@@ -0,0 +1,196 @@
+/*
+  Copyright (C) 2026 hidenorly
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// clang++ -std=c++20 -O2 ShardedRegistry.cxx -pthread
+
+#include "ShardedRegistry.hpp"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <map>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <atomic>
+
+
+// the registry of MyService before the sharding : a single lock for all of the keys
+class MutexRegistry
+{
+protected:
+  std::map<std::string, std::string> mRegistry;
+  std::mutex mMutex;
+
+public:
+  std::string getOr(std::string_view key, const std::string& defaultValue = ""){
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mRegistry.find(std::string(key));
+    return ( it != mRegistry.end() ) ? it->second : defaultValue;
+  }
+
+  bool set(std::string_view key, std::string value){
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::string& current = mRegistry[std::string(key)];
+    if( current == value ) return false;
+    current = std::move(value);
+    return true;
+  }
+};
+
+// the ops/sec of getOr()/set() by the threads on the shared key set. readPercent of the ops are getOr().
+template <typename TRegistry>
+double benchmark_registry(int threadCount, int readPercent, int keyCount = 10000, int count = 200000)
+{
+  TRegistry registry;
+  std::vector<std::string> keys;
+  for(int i = 0; i < keyCount; i++){
+    keys.push_back( "ro.vendor.key." + std::to_string(i) );
+    registry.set(keys.back(), std::to_string(i));
+  }
+
+  std::atomic<size_t> totalReadSize = 0; // not to optimize out the reads
+  std::vector<std::thread> threads;
+  auto startTime = std::chrono::steady_clock::now();
+  for(int i = 0; i < threadCount; i++){
+    threads.push_back( std::thread([&, i](){
+      std::mt19937 random(i);
+      std::uniform_int_distribution<int> keyDistribution(0, keyCount - 1);
+      std::uniform_int_distribution<int> percentDistribution(0, 99);
+      size_t readSize = 0;
+      for(int j = 0; j < count; j++){
+        std::string_view key = keys[ keyDistribution(random) ];
+        if( percentDistribution(random) < readPercent ){
+          readSize += registry.getOr(key).size();
+        } else {
+          registry.set(key, std::to_string(j));
+        }
+      }
+      totalReadSize += readSize;
+    }) );
+  }
+  for(auto& thread : threads){
+    thread.join();
+  }
+  auto endTime = std::chrono::steady_clock::now();
+  return threadCount * count / std::chrono::duration<double>(endTime - startTime).count();
+}
+
+
+int main()
+{
+  // test case 1 : get/set/erase
+  {
+    ShardedRegistry registry;
+    std::cout << "set ro.serialno : " << registry.set("ro.serialno", "dummy") << std::endl;
+    std::cout << "set ro.serialno (same value) : " << registry.set("ro.serialno", "dummy") << std::endl;
+    std::cout << "set ro.serialno (changed) : " << registry.set("ro.serialno", "override") << std::endl;
+    std::string_view key = "ro.serialno";
+    std::cout << "ro.serialno=" << registry.getOr(key) << std::endl;
+    std::cout << "ro.build.fingerprint=" << registry.get("ro.build.fingerprint").value_or("(none)") << std::endl;
+    std::cout << "erase ro.serialno : " << registry.erase(key) << " size=" << registry.size() << std::endl;
+  }
+
+  // test case 2 : the concurrent writers of the disjoint keys
+  {
+    ShardedRegistry registry;
+    const int threadCount = 4;
+    const int keyCount = 10000;
+    std::vector<std::thread> threads;
+    for(int i = 0; i < threadCount; i++){
+      threads.push_back( std::thread([&, i](){
+        for(int j = 0; j < keyCount; j++){
+          registry.set("key." + std::to_string(i) + "." + std::to_string(j), std::to_string(j));
+        }
+      }) );
+    }
+    for(auto& thread : threads){
+      thread.join();
+    }
+    std::cout << "concurrent set : size=" << registry.size() << " (expected " << threadCount * keyCount << ") key.3.9999=" << registry.getOr("key.3.9999") << std::endl;
+  }
+
+  // test case 3 : batch
+  {
+    ShardedRegistry registry;
+    registry.set("key.1", "1");
+    std::vector<size_t> changed = registry.setBatch({ {"key.1", "1"}, {"key.2", "2"}, {"key.3", "3"}, {"key.2", "two"} });
+    std::cout << "setBatch changed indexes :";
+    for(auto& index : changed){
+      std::cout << " " << index;
+    }
+    std::cout << std::endl;
+    auto values = registry.getBatch({ "key.3", "key.2", "key.4", "key.1" });
+    std::cout << "getBatch :";
+    for(auto& value : values){
+      std::cout << " " << value.value_or("(none)");
+    }
+    std::cout << std::endl;
+  }
+
+  // benchmark : set()/getOr() per key vs. setBatch()/getBatch()
+  {
+    const int keyCount = 100000;
+    std::vector<std::string> keys;
+    for(int i = 0; i < keyCount; i++){
+      keys.push_back( "ro.vendor.key." + std::to_string(i) );
+    }
+    for(int batchSize : {1, 16, 256, 4096}){
+      ShardedRegistry registry;
+      auto startTime = std::chrono::steady_clock::now();
+      for(int i = 0; i < keyCount; i += batchSize){
+        std::vector<std::pair<std::string_view, std::string>> entries;
+        for(int j = i; j < std::min(keyCount, i + batchSize); j++){
+          entries.push_back( {keys[j], keys[j]} );
+        }
+        if( batchSize == 1 ){
+          registry.set(entries[0].first, entries[0].second);
+        } else {
+          registry.setBatch(std::move(entries));
+        }
+      }
+      auto setTime = std::chrono::steady_clock::now();
+      size_t foundCount = 0;
+      for(int i = 0; i < keyCount; i += batchSize){
+        std::vector<std::string_view> batchKeys(keys.begin() + i, keys.begin() + std::min(keyCount, i + batchSize));
+        if( batchSize == 1 ){
+          foundCount += registry.get(batchKeys[0]).has_value();
+        } else {
+          for(auto& value : registry.getBatch(batchKeys)){
+            foundCount += value.has_value();
+          }
+        }
+      }
+      auto getTime = std::chrono::steady_clock::now();
+      std::cout << "batch=" << batchSize << " set[Mkeys/sec] : " << keyCount / std::chrono::duration<double>(setTime - startTime).count() / 1e6 << " get[Mkeys/sec] : " << keyCount / std::chrono::duration<double>(getTime - setTime).count() / 1e6 << " found=" << foundCount << std::endl;
+    }
+  }
+
+  // benchmark : the single lock vs. the shards
+  const int maxThreadCount = std::max(8, (int)std::thread::hardware_concurrency());
+  for(int readPercent : {90, 50}){
+    std::cout << "benchmark registry get:set=" << readPercent << ":" << (100 - readPercent) << " [Mops/sec]" << std::endl;
+    std::cout << std::setw(8) << "threads" << std::setw(10) << "mutex" << std::setw(10) << "shard=1" << std::setw(10) << "shard=16" << std::setw(10) << "shard=64" << std::endl;
+    for(int threadCount = 1; threadCount <= maxThreadCount; threadCount *= 2){
+      std::cout << std::fixed << std::setprecision(2) << std::setw(8) << threadCount;
+      std::cout << std::setw(10) << benchmark_registry<MutexRegistry>(threadCount, readPercent) / 1e6;
+      std::cout << std::setw(10) << benchmark_registry<TShardedRegistry<std::string, 1>>(threadCount, readPercent) / 1e6;
+      std::cout << std::setw(10) << benchmark_registry<TShardedRegistry<std::string, 16>>(threadCount, readPercent) / 1e6;
+      std::cout << std::setw(10) << benchmark_registry<TShardedRegistry<std::string, 64>>(threadCount, readPercent) / 1e6 << std::endl;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,217 @@
+/*
+  Copyright (C) 2026 hidenorly
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef __SHARDED_REGISTRY_HPP__
+#define __SHARDED_REGISTRY_HPP__
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <shared_mutex>
+#include <mutex>
+#include <optional>
+#include <array>
+#include <functional>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+
+// key-value registry for the concurrent readers and writers.
+// The keys are split to SHARD_COUNT hash maps and each of them has the own reader-writer lock,
+// then the accesses to the different shards don't contend. The lookups by std::string_view don't allocate std::string.
+template <typename TValue = std::string, size_t SHARD_COUNT = 16>
+class TShardedRegistry
+{
+protected:
+  struct StringHash
+  {
+    using is_transparent = void;
+    size_t operator()(std::string_view key) const noexcept {
+      return std::hash<std::string_view>()(key);
+    }
+  };
+
+  using MAP = std::unordered_map<std::string, TValue, StringHash, std::equal_to<>>;
+
+  // on the own cache line not to share it with the neighbor shard's lock
+  struct alignas(64) Shard
+  {
+    mutable std::shared_mutex mutex;
+    MAP map;
+  };
+
+  std::array<Shard, SHARD_COUNT> mShards;
+
+  // the upper bits of the mixed hash then the shard isn't correlated with the bucket in the shard
+  static size_t getShardIndex(std::string_view key) noexcept {
+    return (size_t)( ( (uint64_t)StringHash()(key) * 0x9E3779B97F4A7C15ULL ) >> 32 ) % SHARD_COUNT;
+  }
+
+  Shard& getShard(std::string_view key) noexcept {
+    return mShards[ getShardIndex(key) ];
+  }
+
+  const Shard& getShard(std::string_view key) const noexcept {
+    return mShards[ getShardIndex(key) ];
+  }
+
+  // the indexes of the keys grouped by the shard. The order in the shard is kept.
+  template <typename KEY_AT>
+  static std::vector<size_t> getShardOrder(size_t count, KEY_AT keyAt, std::vector<size_t>& shardIndexes){
+    std::vector<size_t> offsets(SHARD_COUNT + 1, 0);
+    shardIndexes.resize(count);
+    for(size_t i = 0; i < count; i++){
+      shardIndexes[i] = getShardIndex( keyAt(i) );
+      offsets[ shardIndexes[i] + 1 ]++;
+    }
+    for(size_t i = 0; i < SHARD_COUNT; i++){
+      offsets[i + 1] += offsets[i];
+    }
+    std::vector<size_t> order(count);
+    for(size_t i = 0; i < count; i++){
+      order[ offsets[ shardIndexes[i] ]++ ] = i;
+    }
+    return order;
+  }
+
+public:
+  TShardedRegistry() = default;
+  virtual ~TShardedRegistry() = default;
+
+  static constexpr size_t getShardCount(){
+    return SHARD_COUNT;
+  }
+
+  std::optional<TValue> get(std::string_view key) const {
+    const Shard& shard = getShard(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.map.find(key);
+    if( it == shard.map.end() ) return std::nullopt;
+    return it->second;
+  }
+
+  TValue getOr(std::string_view key, const TValue& defaultValue = TValue()) const {
+    const Shard& shard = getShard(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.map.find(key);
+    return ( it != shard.map.end() ) ? it->second : defaultValue;
+  }
+
+  bool contains(std::string_view key) const {
+    const Shard& shard = getShard(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.map.contains(key);
+  }
+
+  // true if the key is added or the value is changed
+  bool set(std::string_view key, TValue value){
+    Shard& shard = getShard(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.map.find(key);
+    if( it == shard.map.end() ){
+      shard.map.emplace( std::string(key), std::move(value) );
+      return true;
+    }
+    if( it->second == value ) return false;
+    it->second = std::move(value);
+    return true;
+  }
+
+  // the values of the keys in the same order. Each shard is locked once for the batch.
+  std::vector<std::optional<TValue>> getBatch(const std::vector<std::string_view>& keys) const {
+    std::vector<std::optional<TValue>> result(keys.size());
+    std::vector<size_t> shardIndexes;
+    std::vector<size_t> order = getShardOrder(keys.size(), [&](size_t i){ return keys[i]; }, shardIndexes);
+    for(size_t begin = 0, end = 0; begin < order.size(); begin = end){
+      const Shard& shard = mShards[ shardIndexes[ order[begin] ] ];
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      for(end = begin; end < order.size() && shardIndexes[ order[end] ] == shardIndexes[ order[begin] ]; end++){
+        auto it = shard.map.find( keys[ order[end] ] );
+        if( it != shard.map.end() ){
+          result[ order[end] ] = it->second;
+        }
+      }
+    }
+    return result;
+  }
+
+  // set the entries in the order of the entries then the last one wins for the same key.
+  // Each shard is locked once for the batch. The indexes of the added or changed entries are returned in the ascending order.
+  std::vector<size_t> setBatch(std::vector<std::pair<std::string_view, TValue>> entries){
+    std::vector<bool> isChanged(entries.size(), false);
+    std::vector<size_t> shardIndexes;
+    std::vector<size_t> order = getShardOrder(entries.size(), [&](size_t i){ return entries[i].first; }, shardIndexes);
+    for(size_t begin = 0, end = 0; begin < order.size(); begin = end){
+      Shard& shard = mShards[ shardIndexes[ order[begin] ] ];
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      for(end = begin; end < order.size() && shardIndexes[ order[end] ] == shardIndexes[ order[begin] ]; end++){
+        auto& [key, value] = entries[ order[end] ];
+        auto it = shard.map.find(key);
+        if( it == shard.map.end() ){
+          shard.map.emplace( std::string(key), std::move(value) );
+          isChanged[ order[end] ] = true;
+        } else if( !( it->second == value ) ){
+          it->second = std::move(value);
+          isChanged[ order[end] ] = true;
+        }
+      }
+    }
+    std::vector<size_t> result;
+    for(size_t i = 0; i < isChanged.size(); i++){
+      if( isChanged[i] ) result.push_back(i);
+    }
+    return result;
+  }
+
+  bool erase(std::string_view key){
+    Shard& shard = getShard(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.map.find(key);
+    if( it == shard.map.end() ) return false;
+    shard.map.erase(it);
+    return true;
+  }
+
+  size_t size() const {
+    size_t result = 0;
+    for(auto& shard : mShards){
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      result += shard.map.size();
+    }
+    return result;
+  }
+
+  // the shards are visited one by one then it's not the snapshot of the whole registry
+  void forEach(std::function<void(const std::string& key, const TValue& value)> func) const {
+    for(auto& shard : mShards){
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      for(auto& [key, value] : shard.map){
+        func(key, value);
+      }
+    }
+  }
+
+  void clear(){
+    for(auto& shard : mShards){
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      shard.map.clear();
+    }
+  }
+};
+
+typedef TShardedRegistry<std::string> ShardedRegistry;
+
+#endif // __SHARDED_REGISTRY_HPP__
@@ -15,6 +15,10 @@
 */
 
 #include "SharedFrameBuffer.hpp"
+#include "SharedFrameSpill.hpp"
+#include "SharedFrameShm.hpp"
+#include <sys/socket.h>
+#include <sys/wait.h>
 #include <chrono>
 #include <stdexcept>
 #include <thread>
@@ -24,14 +28,43 @@ using SharedFrameBuffer = TSharedFrameBuffer<Frame>;
 
 using PSharedFrameBuffer = TSharedFrameBuffer<std::shared_ptr<Frame>>;
 
+using RingSharedFrameBuffer = TSharedFrameBuffer<Frame, RingFrameStoragePolicy>;
 
+typedef std::vector<uint8_t> LargeFrame; // such as YUV buffer
+using LargeSharedFrameBuffer = TSharedFrameBuffer<LargeFrame>;
+using PLargeSharedFrameBuffer = TSharedFrameBuffer<std::shared_ptr<LargeFrame>>;
+using LargeSharedFrameSlotBuffer = TSharedFrameSlotBuffer<LargeFrame>;
+
+using TimestampSharedFrameBuffer = TSharedFrameBuffer<int64_t>; // the frame is the enqueued time
+
+using SpillSharedFrameBuffer = TSharedFrameBuffer<Frame, SpillFrameStoragePolicy, std::chrono::system_clock>;
+
+struct ShmFrame
+{
+  int64_t timestamp; // steady_clock. It's comparable between the processes
+  uint8_t payload[64*1024];
+};
+using ShmSharedFrameBuffer = TSharedFrameBuffer<ShmFrame, ShmFrameStoragePolicy>;
+
+
+template<typename TBuffer>
+void print_buffer_stat(TBuffer& buffers)
+{
+  auto stat = buffers.getBufferStat();
+  std::cout << "enqueued=" << stat.enqueuedCount << " trimmed=" << stat.trimmedCount << " ptsMiss=" << stat.ptsMissCount << " feedAhead=" << stat.feedAheadCount << " reanchor=" << stat.reanchorCount << " lockContended=" << stat.lockContendedCount << std::endl;
+  std::cout << "lock wait[uSec] avg=" << std::chrono::duration_cast<std::chrono::microseconds>(stat.lockWait.getAverage()).count() << " p99<" << stat.lockWait.getPercentile(0.99).count() << std::endl;
+  std::cout << "dequeue latency[uSec] count=" << stat.dequeueLatency.count << " avg=" << std::chrono::duration_cast<std::chrono::microseconds>(stat.dequeueLatency.getAverage()).count() << " p50<" << stat.dequeueLatency.getPercentile(0.5).count() << " p99<" << stat.dequeueLatency.getPercentile(0.99).count() << " max=" << std::chrono::duration_cast<std::chrono::microseconds>(stat.dequeueLatency.max).count() << std::endl;
+}
+
+
+template<typename TBuffer = SharedFrameBuffer>
 void test_parallel(void)
 {
   double fps = 60.0f;
-  SharedFrameBuffer buffers(fps, 100);
+  TBuffer buffers(fps, 100);
   auto frameDurationChronoMs = std::chrono::duration_cast<std::chrono::milliseconds>(
       std::chrono::duration<double, std::milli>(1000.0f/fps));
-  auto startPos = std::chrono::system_clock::now();
+  auto startPos = std::chrono::steady_clock::now();
 
   auto producer = [&]() {
     for (int i = 0; i < 100; i++) {
@@ -71,15 +104,507 @@ void test_parallel(void)
   producerThread.join();
   consumerThread.join();
   consumerThread2.join();
+  print_buffer_stat(buffers);
 }
 
 
-int main()
+template<typename TBuffer = SharedFrameBuffer>
+void test_cursor(void)
+{
+  double fps = 60.0f;
+  TBuffer buffers(fps, 0);
+  auto frameDurationChronoMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::duration<double, std::milli>(1000.0f/fps));
+  const int count = 60;
+
+  auto fastCursor = buffers.openCursor("fast");
+  auto slowCursor = buffers.openCursor("slow");
+
+  auto producer = [&]() {
+    for (int i = 0; i < count; i++) {
+      buffers.enqueueFrames( std::vector<Frame>{ i } );
+      std::this_thread::sleep_for(frameDurationChronoMs);
+    }
+  };
+
+  auto consumer = [&](std::shared_ptr<typename TBuffer::Cursor> cursor, std::chrono::milliseconds interval) {
+    int matched = 0;
+    Frame frame;
+    while( matched < count ){
+      if( cursor->read(frame) == FrameReadStatus::OK ){
+        if( frame == matched ){
+          matched++;
+        }
+      } else {
+        std::this_thread::sleep_for(interval);
+      }
+      std::this_thread::sleep_for(interval);
+    }
+    std::cout << "matched count :" << matched << std::endl;
+  };
+
+  std::thread producerThread(producer);
+  std::thread consumerThread(consumer, fastCursor, frameDurationChronoMs/2);
+  std::thread consumerThread2(consumer, slowCursor, frameDurationChronoMs*2);
+
+  producerThread.join();
+  consumerThread.join();
+  consumerThread2.join();
+
+  for(auto& stat : buffers.getCursorStats()){
+    std::cout << "cursor " << stat.name << " : position=" << stat.position << " lag=" << stat.lag << " maxLag=" << stat.maxLag << " read=" << stat.readCount << " dropped=" << stat.droppedCount << std::endl;
+  }
+  print_buffer_stat(buffers);
+}
+
+
+void test_wait(void)
 {
   double fps = 60.0f;
+  SharedFrameBuffer buffers(fps, 100);
   auto frameDurationChronoMs = std::chrono::duration_cast<std::chrono::milliseconds>(
       std::chrono::duration<double, std::milli>(1000.0f/fps));
+
+  std::thread producerThread([&]() {
+    for (int i = 0; i < 30; i++) {
+      buffers.enqueueFrames( std::vector<Frame>{ i } );
+      std::this_thread::sleep_for(frameDurationChronoMs);
+    }
+  });
+
+  Frame frame;
+  auto current = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+  if( buffers.waitForFrame( frame, current, std::chrono::seconds(1) ) == FrameReadStatus::OK ){
+    std::cout << "waitForFrame : " << frame << std::endl;
+  }
+  std::vector<Frame> frames;
+  FrameReadStatus status = buffers.waitForFrames( frames, current, current + frameDurationChronoMs * 5, std::chrono::seconds(1), frameDurationChronoMs );
+  std::cout << "waitForFrames : " << frames.size() << " frames " << ((status == FrameReadStatus::OK) ? "ok" : "end of data") << std::endl;
+  status = buffers.waitForFrame( frame, current + std::chrono::seconds(10), std::chrono::milliseconds(10) );
+  std::cout << "waitForFrame for the far future : " << ((status == FrameReadStatus::OK) ? "ok" : "timeout") << std::endl;
+
+  producerThread.join();
+}
+
+
+void test_drift(void)
+{
+  double fps = 60.0f;
+  auto frameDurationChronoMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::duration<double, std::milli>(1000.0f/fps));
+
+  // the PTS isn't truncated to 16ms at 60fps
+  auto startPos = std::chrono::steady_clock::now();
+  SharedFrameBuffer buffers(fps, 0);
+  std::vector<Frame> frames;
+  for(int i=0; i<200; i++){
+    frames.push_back(i);
+  }
+  buffers.enqueueFrames( frames );
+  std::cout << "frame at 2sec : " << buffers.dequeueFrame( startPos + std::chrono::seconds(2) ) << std::endl;
+
+  // the producer stalls. The PTS is re-anchored to the enqueued time.
+  SharedFrameBuffer buffers2(fps, 0);
+  for(int i=0; i<10; i++){
+    buffers2.enqueueFrames( std::vector<Frame>{ i } );
+    std::this_thread::sleep_for(frameDurationChronoMs);
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(300));
+  auto current = std::chrono::steady_clock::now();
+  buffers2.enqueueFrames( std::vector<Frame>{ 10 } );
+  try{
+    std::cout << "frame after stall : " << buffers2.dequeueFrame( current ) << " (reanchored:" << buffers2.getReanchorCount() << ")" << std::endl;
+  } catch (const std::invalid_argument& e) {
+    std::cout << e.what() << std::endl;
+  }
+}
+
+
+void test_spill(void)
+{
+  double fps = 60.0f;
+  std::string spillPath = "/tmp/SharedFrameBuffer_spill";
+  std::filesystem::remove_all(spillPath);
   auto startPos = std::chrono::system_clock::now();
+
+  std::vector<Frame> frames;
+  for(int i=0; i<100; i++){
+    frames.push_back(i);
+  }
+  {
+    // hot window is 10 frames. the older frames go to the segment files
+    SpillSharedFrameBuffer buffers(fps, 10);
+    buffers.getStorage().open(spillPath, 32);
+    buffers.enqueueFrames( frames );
+    std::cout << "spilled : " << buffers.getStorage().getSpilledCount() << std::endl;
+    std::cout << "oldest frame : " << buffers.dequeueFrame( startPos ) << std::endl;
+    std::cout << "frame at 1sec : " << buffers.dequeueFrame( startPos + std::chrono::seconds(1) ) << std::endl;
+  }
+  {
+    // restart : re-map the existing segments. The stray files which aren't the segments are skipped.
+    std::filesystem::copy_file(spillPath + "/segment_000000000000.bin", spillPath + "/segment_backup.bin");
+    SpillSharedFrameBuffer buffers(fps, 10);
+    buffers.getStorage().open(spillPath, 32);
+    std::cout << "re-mapped : " << buffers.getStorage().getSpilledCount() << std::endl;
+    std::cout << "oldest frame : " << buffers.dequeueFrame( startPos ) << std::endl;
+  }
+  std::filesystem::remove_all(spillPath);
+}
+
+
+void test_rate_conversion(void)
+{
+  double fps = 240.0f;
+  SharedFrameBuffer buffers(fps, 0);
+  std::vector<Frame> frames;
+  for(int i=0; i<240; i++){
+    frames.push_back(i);
+  }
+  buffers.enqueueFrames( frames );
+
+  auto printFrames = [](const std::string& name, const std::vector<Frame>& frames){
+    std::cout << name << " :";
+    for(int i=0; i<std::min<int>(frames.size(), 8); i++){
+      std::cout << " " << frames[i];
+    }
+    std::cout << " ... (" << frames.size() << " frames)" << std::endl;
+  };
+
+  // 240fps to 30/60/120fps by the single pass
+  auto converter = buffers.openRateConverter(60);
+  converter->addSink(30);
+  converter->addSink(120);
+  auto endPTS = converter->getNextPTS() + std::chrono::milliseconds(500);
+  std::vector<std::vector<Frame>> result;
+  FrameReadStatus status = converter->read( result, endPTS );
+  printFrames("60fps", result[0]);
+  printFrames("30fps", result[1]);
+  printFrames("120fps", result[2]);
+  // continue from the previous read(). The buffer has only 1sec.
+  status = converter->read( result, endPTS + std::chrono::milliseconds(600) );
+  printFrames("60fps next", result[0]);
+  std::cout << ((status == FrameReadStatus::END_OF_DATA) ? "end of data" : "ok") << std::endl;
+
+  // 240fps to 100fps
+  std::vector<Frame> result2;
+  auto nearest = buffers.openRateConverter(100, 1, FrameRateConversion::NEAREST);
+  nearest->read( result2, nearest->getNextPTS() + std::chrono::milliseconds(100) );
+  printFrames("100fps nearest", result2);
+  auto dropDuplicate = buffers.openRateConverter(100, 1, FrameRateConversion::DROP_DUPLICATE);
+  dropDuplicate->read( result2, dropDuplicate->getNextPTS() + std::chrono::milliseconds(100) );
+  printFrames("100fps drop/duplicate", result2);
+  auto blend = buffers.openRateConverter(100, 1, FrameRateConversion::BLEND, [](const Frame& before, const Frame& after, double ratio){
+    return (Frame)std::lround( before + (after - before) * ratio );
+  });
+  blend->read( result2, blend->getNextPTS() + std::chrono::milliseconds(100) );
+  printFrames("100fps blend", result2);
+
+  // opened on the empty buffer : the output PTS is anchored to the first enqueued frame
+  SharedFrameBuffer emptyBuffers(fps, 0);
+  auto deferred = emptyBuffers.openRateConverter(60);
+  status = deferred->read( result2, std::chrono::steady_clock::now() );
+  std::cout << "empty : " << result2.size() << " frames " << ((status == FrameReadStatus::END_OF_DATA) ? "end of data" : "ok") << std::endl;
+  emptyBuffers.enqueueFrames( frames );
+  deferred->read( result2, deferred->getNextPTS() + std::chrono::milliseconds(100) );
+  printFrames("60fps after the first frame", result2);
+}
+
+
+// latency from enqueue to the consumer's wake up
+void benchmark_wait_latency(double fps, bool isPolling, int count = 120)
+{
+  TimestampSharedFrameBuffer buffers(fps, 100);
+  auto frameDurationChronoMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::duration<double, std::milli>(1000.0f/fps));
+  auto cursor = buffers.openCursor();
+
+  std::thread producerThread([&]() {
+    for (int i = 0; i < count; i++) {
+      buffers.enqueueFrames( std::vector<int64_t>{ std::chrono::steady_clock::now().time_since_epoch().count() } );
+      std::this_thread::sleep_for(frameDurationChronoMs);
+    }
+  });
+
+  std::chrono::steady_clock::duration totalLatency = std::chrono::steady_clock::duration::zero();
+  int64_t frame;
+  for(int i = 0; i < count; i++){
+    if( isPolling ){
+      while( cursor->read(frame) != FrameReadStatus::OK ){
+        std::this_thread::sleep_for(frameDurationChronoMs);
+      }
+    } else {
+      while( cursor->read(frame, std::chrono::seconds(1)) != FrameReadStatus::OK ){
+      }
+    }
+    totalLatency += std::chrono::steady_clock::now() - std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(frame));
+  }
+  producerThread.join();
+
+  std::cout << "latency[uSec] " << (isPolling ? "polling" : "waiting") << " at " << fps << "fps : " << std::chrono::duration_cast<std::chrono::microseconds>(totalLatency / count).count() << std::endl;
+}
+
+
+// 240fps source to 30/60/120fps sinks
+void benchmark_rate_conversion(int depth = 2400, int count = 1000)
+{
+  double fps = 240.0f;
+  SharedFrameBuffer buffers(fps, depth);
+  std::vector<Frame> frames;
+  for(int i=0; i<depth; i++){
+    frames.push_back(i);
+  }
+  buffers.enqueueFrames( frames );
+  auto pConverter = buffers.openRateConverter(fps);
+  auto windowStart = pConverter->getNextPTS() + std::chrono::seconds(depth / (int)fps / 2);
+  auto windowEnd = windowStart + std::chrono::seconds(1);
+
+  auto startTime = std::chrono::steady_clock::now();
+  for(int i=0; i<count; i++){
+    std::vector<Frame> result;
+    try{
+      for(int rate : {30, 60, 120}){
+        for(auto pos = windowStart; pos < windowEnd; pos += std::chrono::nanoseconds(1000000000LL / rate)){
+          result.push_back( buffers.dequeueFrame(pos) );
+        }
+      }
+    } catch (const std::invalid_argument& e) {
+    }
+  }
+  auto endTime = std::chrono::steady_clock::now();
+  std::cout << "latency[uSec] 1sec window to 30/60/120fps by dequeueFrame : " << std::chrono::duration_cast<std::chrono::microseconds>((endTime - startTime) / count).count() << std::endl;
+
+  startTime = std::chrono::steady_clock::now();
+  for(int i=0; i<count; i++){
+    std::vector<Frame> result;
+    for(int rate : {30, 60, 120}){
+      auto pConverter = buffers.openRateConverter(rate, 1, FrameRateConversion::NEAREST, nullptr, windowStart);
+      pConverter->read( result, windowEnd );
+    }
+  }
+  endTime = std::chrono::steady_clock::now();
+  std::cout << "latency[uSec] 1sec window to 30/60/120fps by RateConverter per sink : " << std::chrono::duration_cast<std::chrono::microseconds>((endTime - startTime) / count).count() << std::endl;
+
+  startTime = std::chrono::steady_clock::now();
+  for(int i=0; i<count; i++){
+    std::vector<std::vector<Frame>> result;
+    auto pConverter = buffers.openRateConverter(30, 1, FrameRateConversion::NEAREST, nullptr, windowStart);
+    pConverter->addSink(60);
+    pConverter->addSink(120);
+    pConverter->read( result, windowEnd );
+  }
+  endTime = std::chrono::steady_clock::now();
+  std::cout << "latency[uSec] 1sec window to 30/60/120fps by RateConverter single pass : " << std::chrono::duration_cast<std::chrono::microseconds>((endTime - startTime) / count).count() << std::endl;
+}
+
+
+// producer process -> consumer process by the shared memory or the socket
+void benchmark_two_process(bool isSharedMemory, int count = 2000)
+{
+  const std::string shmName = "/SharedFrameBuffer_bench";
+  int sockets[2];
+  if( !isSharedMemory && ::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0 ){
+    return;
+  }
+  auto producerBuffers = std::make_unique<ShmSharedFrameBuffer>(60.0f, 64);
+  if( isSharedMemory ){
+    producerBuffers->getStorage().create(shmName);
+  }
+
+  pid_t pid = ::fork();
+  if( pid == 0 ){
+    // consumer process
+    std::chrono::steady_clock::duration totalLatency = std::chrono::steady_clock::duration::zero();
+    int received = 0;
+    auto frame = std::make_unique<ShmFrame>();
+    auto startTime = std::chrono::steady_clock::now();
+    if( isSharedMemory ){
+      ShmSharedFrameBuffer buffers(60.0f, 64);
+      buffers.getStorage().attach(shmName);
+      auto cursor = buffers.openCursor();
+      int64_t timestamp = 0;
+      while( received < count ){
+        // visit the frame in the mapping instead of copying 64KB out
+        if( cursor->visit([&](const ShmFrame& frame){ timestamp = frame.timestamp; }) == FrameReadStatus::OK ){
+          totalLatency += std::chrono::steady_clock::now() - std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(timestamp));
+          received++;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+      std::cout << "dropped(shm) : " << cursor->getStat().droppedCount << std::endl;
+    } else {
+      ::close(sockets[0]);
+      while( received < count ){
+        size_t size = 0;
+        while( size < sizeof(ShmFrame) ){
+          ssize_t n = ::read(sockets[1], reinterpret_cast<uint8_t*>(frame.get()) + size, sizeof(ShmFrame) - size);
+          if( n <= 0 ) break;
+          size += n;
+        }
+        if( size < sizeof(ShmFrame) ) break;
+        totalLatency += std::chrono::steady_clock::now() - std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(frame->timestamp));
+        received++;
+      }
+    }
+    auto endTime = std::chrono::steady_clock::now();
+    if( received ){
+      std::cout << "latency[uSec] two process by " << (isSharedMemory ? "shared memory" : "socket") << " : " << std::chrono::duration_cast<std::chrono::microseconds>(totalLatency / received).count();
+      std::cout << " throughput[frames/sec] : " << (int64_t)(received / std::chrono::duration<double>(endTime - startTime).count()) << std::endl;
+    }
+    ::_exit(0);
+  }
+
+  // producer process
+  auto frame = std::make_unique<ShmFrame>();
+  std::memset(frame->payload, 0x5a, sizeof(frame->payload));
+  std::this_thread::sleep_for(std::chrono::milliseconds(100)); // wait for the consumer to attach
+  for(int i = 0; i < count; i++){
+    frame->timestamp = std::chrono::steady_clock::now().time_since_epoch().count();
+    if( isSharedMemory ){
+      producerBuffers->enqueueFrame( *frame );
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    } else {
+      ::write(sockets[0], frame.get(), sizeof(ShmFrame));
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+  if( !isSharedMemory ){
+    ::close(sockets[0]);
+    ::close(sockets[1]);
+  }
+  ::waitpid(pid, nullptr, 0);
+}
+
+
+template<typename TBuffer = SharedFrameBuffer>
+void benchmark_lookup(const std::string& name, int depth, int count = 10000)
+{
+  double fps = 60.0f;
+  auto frameDurationChronoMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::duration<double, std::milli>(1000.0f/fps));
+  auto startPos = std::chrono::steady_clock::now();
+  TBuffer buffers(fps, depth);
+
+  std::vector<Frame> frames;
+  for(int i=0; i<depth; i++){
+    frames.push_back(i);
+  }
+  buffers.enqueueFrames( frames );
+
+  // look up the PTS spread over the whole depth
+  int64_t sum = 0;
+  auto startTime = std::chrono::steady_clock::now();
+  for(int i=0; i<count; i++){
+    sum += buffers.dequeueFrame( startPos + frameDurationChronoMs * ((i * 7919) % depth) );
+  }
+  auto endTime = std::chrono::steady_clock::now();
+
+  auto latency = (endTime - startTime) / count;
+  std::cout << "latency[nSec] dequeueFrame(" << name << ", depth=" << depth << ") : " << std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count() << " (checksum:" << sum << ")" << std::endl;
+}
+
+
+template<typename TBuffer = SharedFrameBuffer>
+void benchmark_range_read(const std::string& name, int depth, int count = 1000)
+{
+  double fps = 60.0f;
+  auto frameDurationChronoMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::duration<double, std::milli>(1000.0f/fps));
+  auto startPos = std::chrono::steady_clock::now();
+  TBuffer buffers(fps, depth);
+
+  std::vector<Frame> frames;
+  for(int i=0; i<depth; i++){
+    frames.push_back(i);
+  }
+  buffers.enqueueFrames( frames );
+
+  // one second window from the middle of the buffer
+  auto windowStart = startPos + frameDurationChronoMs * (depth / 2);
+  auto windowEnd = windowStart + std::chrono::seconds(1);
+
+  auto startTime = std::chrono::steady_clock::now();
+  for(int i=0; i<count; i++){
+    std::vector<Frame> result;
+    try{
+      for(auto pos = windowStart; pos < windowEnd; pos += frameDurationChronoMs){
+        result.push_back( buffers.dequeueFrame(pos) );
+      }
+    } catch (const std::invalid_argument& e) {
+    }
+  }
+  auto endTime = std::chrono::steady_clock::now();
+  std::cout << "latency[uSec] 1sec window by dequeueFrame(" << name << ", depth=" << depth << ") : " << std::chrono::duration_cast<std::chrono::microseconds>((endTime - startTime) / count).count() << std::endl;
+
+  std::vector<Frame> result;
+  startTime = std::chrono::steady_clock::now();
+  for(int i=0; i<count; i++){
+    buffers.readFrames( result, windowStart, windowEnd, frameDurationChronoMs );
+  }
+  endTime = std::chrono::steady_clock::now();
+  std::cout << "latency[uSec] 1sec window by readFrames(" << name << ", depth=" << depth << ") : " << std::chrono::duration_cast<std::chrono::microseconds>((endTime - startTime) / count).count() << std::endl;
+}
+
+
+void benchmark_large_frame(int count = 200, size_t frameSize = 1920*1080*2)
+{
+  double fps = 60.0f;
+  const int storingSize = 8;
+  int64_t sum = 0;
+
+  // by value : copied at enqueue and at dequeue
+  {
+    LargeSharedFrameBuffer buffers(fps, storingSize);
+    auto startTime = std::chrono::steady_clock::now();
+    for(int i=0; i<count; i++){
+      std::vector<LargeFrame> frames = { LargeFrame(frameSize, (uint8_t)i) };
+      buffers.enqueueFrames( frames );
+      LargeFrame frame = buffers.dequeueFrame();
+      sum += frame[0];
+    }
+    auto endTime = std::chrono::steady_clock::now();
+    std::cout << "latency[uSec] enqueue/dequeue by value : " << std::chrono::duration_cast<std::chrono::microseconds>((endTime - startTime) / count).count() << std::endl;
+  }
+
+  // shared_ptr : allocated per frame
+  {
+    PLargeSharedFrameBuffer buffers(fps, storingSize);
+    auto startTime = std::chrono::steady_clock::now();
+    for(int i=0; i<count; i++){
+      std::vector<std::shared_ptr<LargeFrame>> frames = { std::make_shared<LargeFrame>(frameSize, (uint8_t)i) };
+      buffers.enqueueFrames( frames );
+      std::shared_ptr<LargeFrame> frame = buffers.dequeueFrame();
+      sum += (*frame)[0];
+    }
+    auto endTime = std::chrono::steady_clock::now();
+    std::cout << "latency[uSec] enqueue/dequeue by shared_ptr : " << std::chrono::duration_cast<std::chrono::microseconds>((endTime - startTime) / count).count() << std::endl;
+  }
+
+  // slot : written in place and recycled by the pool
+  {
+    LargeSharedFrameSlotBuffer buffers(fps, storingSize);
+    auto startTime = std::chrono::steady_clock::now();
+    for(int i=0; i<count; i++){
+      auto slot = buffers.acquireSlot();
+      slot->resize(frameSize);
+      std::fill(slot->begin(), slot->end(), (uint8_t)i);
+      buffers.commitSlot( std::move(slot) );
+      LargeSharedFrameSlotBuffer::FrameHandle frame = buffers.dequeueFrame();
+      sum += (*frame)[0];
+    }
+    auto endTime = std::chrono::steady_clock::now();
+    std::cout << "latency[uSec] enqueue/dequeue by slot : " << std::chrono::duration_cast<std::chrono::microseconds>((endTime - startTime) / count).count() << " (pooled:" << buffers.getPool()->getPooledCount() << ")" << std::endl;
+  }
+  std::cout << "checksum:" << sum << std::endl;
+}
+
+
+int main()
+{
+  double fps = 60.0f;
+  auto frameDurationChronoMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::duration<double, std::milli>(1000.0f/fps));
+  auto startPos = std::chrono::steady_clock::now();
   std::vector<Frame> frames = { 0, 1, 2, 3, 4 };
 
   auto current = startPos;
@@ -146,6 +671,79 @@ int main()
   std::cout << "test case7" << std::endl;
   test_parallel();
 
+  //test case 8
+  std::cout << "test case8" << std::endl;
+  test_parallel<RingSharedFrameBuffer>();
+
+  //test case 9
+  std::cout << "test case9" << std::endl;
+  {
+    current = std::chrono::steady_clock::now();
+    SharedFrameBuffer buffers9(fps, 10);
+    buffers9.enqueueFrames( frames );
+    std::vector<Frame> result;
+    FrameReadStatus status = buffers9.readFrames( result, current, current + frameDurationChronoMs * 10, frameDurationChronoMs );
+    for(auto& frame : result){
+      std::cout << frame << std::endl;
+    }
+    std::cout << ((status == FrameReadStatus::END_OF_DATA) ? "end of data" : "ok") << std::endl;
+  }
+
+  //test case 10
+  std::cout << "test case10" << std::endl;
+  test_cursor<SharedFrameBuffer>();
+  test_cursor<RingSharedFrameBuffer>();
+
+  //test case 11
+  std::cout << "test case11" << std::endl;
+  test_wait();
+
+  //test case 12
+  std::cout << "test case12" << std::endl;
+  test_drift();
+
+  //test case 13
+  std::cout << "test case13" << std::endl;
+  test_spill();
+
+  //test case 14
+  std::cout << "test case14" << std::endl;
+  test_rate_conversion();
+
+  // benchmark : lookup cost against the buffer depth
+  std::cout << "benchmark lookup" << std::endl;
+  for(int depth : {100, 1000, 10000, 100000}){
+    benchmark_lookup<SharedFrameBuffer>("vector", depth);
+    benchmark_lookup<RingSharedFrameBuffer>("ring", depth);
+  }
+
+  // benchmark : range read
+  std::cout << "benchmark range read" << std::endl;
+  for(int depth : {1000, 10000}){
+    benchmark_range_read<SharedFrameBuffer>("vector", depth);
+    benchmark_range_read<RingSharedFrameBuffer>("ring", depth);
+  }
+
+  // benchmark : frame rate conversion
+  std::cout << "benchmark rate conversion" << std::endl;
+  benchmark_rate_conversion();
+
+  // benchmark : latency of polling and waiting
+  std::cout << "benchmark wait latency" << std::endl;
+  for(double fps : {60.0f, 240.0f}){
+    benchmark_wait_latency(fps, true);
+    benchmark_wait_latency(fps, false);
+  }
+
+  // benchmark : two process
+  std::cout << "benchmark two process" << std::endl;
+  benchmark_two_process(false);
+  benchmark_two_process(true);
+
+  // benchmark : large frame copy
+  std::cout << "benchmark large frame" << std::endl;
+  benchmark_large_frame();
+
 
   return 0;
 }
\ No newline at end of file
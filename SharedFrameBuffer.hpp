@@ -14,109 +14,1221 @@
    limitations under the License.
 */
 
+#ifndef __SHARED_FRAME_BUFFER_HPP__
+#define __SHARED_FRAME_BUFFER_HPP__
+
 #include <iostream>
 #include <vector>
 #include <utility>
 #include <chrono>
 #include <stdexcept>
 #include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <algorithm>
+#include <type_traits>
+#include <functional>
+#include <array>
+#include <string>
+#include <condition_variable>
+#include <cmath>
+#include <bit>
+#include <span>
+
 
+// --- storage policies for TSharedFrameBuffer
 
-template<typename Frame> class TSharedFrameBuffer
+// vector storage : the same as the original impl. Guarded by TSharedFrameBuffer's mutex.
+template<typename Frame, typename TimePoint> class TVectorFrameStorage
 {
+public:
+  static constexpr bool IS_LOCK_FREE = false;
+
 protected:
-  float mSamplingRatePerSecond;
-  std::vector< std::pair<std::chrono::system_clock::time_point, Frame> > mFrames;
-  int mFramePos;
-  int mStoringSize;
-  std::chrono::system_clock::time_point mLastTime;
-  std::chrono::milliseconds mFrameDurationChronoMs;
-  std::mutex mMutex;
+  std::vector< std::pair<TimePoint, Frame> > mFrames;
+  size_t mStoringSize;
+  int64_t mHeadIndex; // frame index of mFrames.front()
 
 public:
-  TSharedFrameBuffer(float nSamplingRatePerSecond=60.0f, int storingSize=0 /* infinite */):mSamplingRatePerSecond(nSamplingRatePerSecond),mFramePos(0), mStoringSize(storingSize){
-    mLastTime = std::chrono::system_clock::now();
-    mFrameDurationChronoMs = std::chrono::duration_cast<std::chrono::milliseconds>(
-        std::chrono::duration<double, std::milli>(1000.0f/nSamplingRatePerSecond));
+  TVectorFrameStorage(size_t storingSize=0 /* infinite */):mStoringSize(storingSize), mHeadIndex(0){
   }
 
-  virtual ~TSharedFrameBuffer(){
+  template<typename TFrame> void push(int64_t index, const TimePoint& pts, TFrame&& frame){
+    if( mFrames.empty() ){
+      mHeadIndex = index;
+    }
+    mFrames.emplace_back(pts, std::forward<TFrame>(frame));
+  }
 
+  void trim(){
+    if( mStoringSize && mFrames.size() > mStoringSize ){
+      // erase the overflowed frames at once instead of erasing the front one by one
+      trimBefore(mHeadIndex + (mFrames.size()-mStoringSize));
+    }
   }
 
-  void enqueueFrames(const std::vector<Frame>& frames){
-    std::lock_guard<std::mutex> lock(mMutex);
-    auto now = std::chrono::system_clock::now();
-    auto current = mLastTime;
-    if(now < current){
-      std::cout << "Feed is larger than consuming" << std::endl;
+  // reclaim the frames before the index
+  void trimBefore(int64_t index){
+    if( index > mHeadIndex ){
+      size_t count = std::min((size_t)(index - mHeadIndex), mFrames.size());
+      mFrames.erase(mFrames.begin(), mFrames.begin()+count);
+      mHeadIndex += count;
     }
-    for(auto frame : frames){
-      mFrames.push_back(std::make_pair(current, frame));
-      mFramePos++;
-      current += mFrameDurationChronoMs;
+  }
+
+  int64_t getHeadIndex(){
+    return mHeadIndex;
+  }
+
+  int64_t getTailIndex(){
+    return mHeadIndex + mFrames.size();
+  }
+
+  // visit the frame of the index in place. false if it's not retained
+  template<typename Visitor> bool visit(int64_t index, Visitor visitor){
+    if( index >= mHeadIndex && index < getTailIndex() ){
+      auto& frame = mFrames[index - mHeadIndex];
+      visitor(frame.first, frame.second);
+      return true;
     }
-    if( mStoringSize && mFrames.size() > mStoringSize ){
-      // mFrames.erase(mFrames.begin(), mFrames.begin()+(mStoringSize-mFrames.size()));
-      for(int i=0; i<mStoringSize-mFrames.size(); i++){
-        mFrames.erase(mFrames.begin()); 
+    return false;
+  }
+
+  bool read(int64_t index, TimePoint& outPts, Frame* pOutFrame = nullptr){
+    return visit(index, [&](const TimePoint& pts, const Frame& frame){
+      outPts = pts;
+      if( pOutFrame ){
+        *pOutFrame = frame;
       }
+    });
+  }
+
+  bool empty(){
+    return mFrames.empty();
+  }
+
+  // the frames are sorted by PTS since the PTS is assigned in increasing order
+  typename std::vector< std::pair<TimePoint, Frame> >::iterator lowerBound(const TimePoint& nPTS){
+    return std::lower_bound(mFrames.begin(), mFrames.end(), nPTS, [](const std::pair<TimePoint, Frame>& frame, const TimePoint& pts){
+      return frame.first < pts;
+    });
+  }
+
+  int64_t findFirstIndex(const TimePoint& nPTS){
+    return mHeadIndex + (lowerBound(nPTS) - mFrames.begin());
+  }
+
+  // visit the first frame at or after nPTS in place. false if there is no such frame
+  template<typename Visitor> bool visitFirst(const TimePoint& nPTS, Visitor visitor){
+    auto it = lowerBound(nPTS);
+    if( it != mFrames.end() ){
+      visitor(it->first, it->second);
+      return true;
     }
-    mLastTime = current;
+    return false;
   }
 
-  bool isEmpty(std::chrono::system_clock::time_point nPTS = std::chrono::system_clock::from_time_t(0)){
-    std::lock_guard<std::mutex> lock(mMutex);
-    if( nPTS == std::chrono::system_clock::from_time_t(0) ){
-      return mFrames.empty();
-    } else {
-      for(auto& frame: mFrames){
-        if(frame.first>=nPTS){
-          return false;
-        }
+  bool findFirst(const TimePoint& nPTS, Frame* pOutFrame = nullptr){
+    return visitFirst(nPTS, [&](const TimePoint&, const Frame& frame){
+      if( pOutFrame ){
+        *pOutFrame = frame;
+      }
+    });
+  }
+
+  // visit the frames from the first frame at or after nPTS until the visitor returns false
+  template<typename Visitor> void visitFrom(const TimePoint& nPTS, Visitor visitor){
+    for(auto it = lowerBound(nPTS); it != mFrames.end(); it++){
+      if( !visitor(it->first, it->second) ){
+        break;
       }
     }
+  }
+};
+
+// ring storage : fixed capacity. The producers claim the frame index by atomic and readers don't remove the frame.
+//   head : the oldest retained frame index
+//   tail : the next frame index
+// Each slot has the published frame index and the small reader/writer state instead of the mutex.
+// The writer only waits for in-flight readers of the same slot when it laps the ring.
+template<typename Frame, typename TimePoint> class TRingFrameStorage
+{
+public:
+  static constexpr bool IS_LOCK_FREE = true;
+  static constexpr size_t DEFAULT_CAPACITY = 1024;
+
+protected:
+  struct Slot
+  {
+    std::atomic<int64_t> index = -1; // published frame index. -1:empty
+    std::atomic<int> state = 0;      // -1:writing, 0:idle, n:n readers
+    TimePoint pts;
+    Frame frame;
+  };
+
+  const size_t mCapacity;
+  std::unique_ptr<Slot[]> mSlots;
+  std::atomic<int64_t> mHead;
+  std::atomic<int64_t> mTail;
+
+  static void storeMax(std::atomic<int64_t>& target, int64_t value){
+    int64_t current = target.load(std::memory_order_relaxed);
+    while( current < value && !target.compare_exchange_weak(current, value, std::memory_order_release, std::memory_order_relaxed) ){
+    }
+  }
 
+  bool beginRead(Slot& slot){
+    int state = slot.state.load(std::memory_order_acquire);
+    do {
+      if( state < 0 ){
+        return false; // being overwritten
+      }
+    } while( !slot.state.compare_exchange_weak(state, state+1, std::memory_order_acquire, std::memory_order_acquire) );
     return true;
   }
 
-  Frame dequeueFrame(std::chrono::system_clock::time_point nPTS = std::chrono::system_clock::from_time_t(0)){
-    std::lock_guard<std::mutex> lock(mMutex);
-    Frame result;
-    if( !mFrames.empty() ){
-      if(nPTS == std::chrono::system_clock::from_time_t(0)){
-        result = mFrames.front().second;
+  void endRead(Slot& slot){
+    slot.state.fetch_sub(1, std::memory_order_release);
+  }
+
+public:
+  TRingFrameStorage(size_t storingSize=0 /* DEFAULT_CAPACITY */):mCapacity(storingSize ? storingSize : DEFAULT_CAPACITY), mSlots(new Slot[mCapacity]), mHead(0), mTail(0){
+  }
+
+  size_t capacity() const {
+    return mCapacity;
+  }
+
+  template<typename TFrame> void push(int64_t index, const TimePoint& pts, TFrame&& frame){
+    Slot& slot = mSlots[index % mCapacity];
+    int idle = 0;
+    while( !slot.state.compare_exchange_weak(idle, -1, std::memory_order_acquire, std::memory_order_relaxed) ){
+      idle = 0;
+      std::this_thread::yield();
+    }
+    slot.pts = pts;
+    slot.frame = std::forward<TFrame>(frame);
+    slot.index.store(index, std::memory_order_release);
+    slot.state.store(0, std::memory_order_release);
+
+    storeMax(mTail, index+1);
+    storeMax(mHead, index+1-(int64_t)mCapacity);
+  }
+
+  void trim(){
+    // nothing to do. The head is advanced by push()
+  }
+
+  // reclaim the frames before the index. The slot's frame is released to free its resource such as shared_ptr.
+  void trimBefore(int64_t index){
+    index = std::min(index, mTail.load(std::memory_order_acquire));
+    int64_t head = mHead.load(std::memory_order_acquire);
+    while( head < index && !mHead.compare_exchange_weak(head, index, std::memory_order_acq_rel, std::memory_order_acquire) ){
+    }
+    for(int64_t i = head; i < index; i++){
+      Slot& slot = mSlots[i % mCapacity];
+      int idle = 0;
+      if( slot.index.load(std::memory_order_acquire) == i && slot.state.compare_exchange_strong(idle, -1, std::memory_order_acquire, std::memory_order_relaxed) ){
+        if( slot.index.load(std::memory_order_acquire) == i ){
+          slot.frame = Frame();
+          slot.index.store(-1, std::memory_order_release);
+        }
+        slot.state.store(0, std::memory_order_release);
+      }
+    }
+  }
+
+  int64_t getHeadIndex(){
+    return mHead.load(std::memory_order_acquire);
+  }
+
+  int64_t getTailIndex(){
+    return mTail.load(std::memory_order_acquire);
+  }
+
+  // visit the frame of the index in place. false if it's not published yet or already overwritten
+  template<typename Visitor> bool visit(int64_t index, Visitor visitor){
+    Slot& slot = mSlots[index % mCapacity];
+    bool result = false;
+    if( beginRead(slot) ){
+      if( slot.index.load(std::memory_order_acquire) == index ){
+        visitor(slot.pts, slot.frame);
+        result = true;
+      }
+      endRead(slot);
+    }
+    return result;
+  }
+
+  bool read(int64_t index, TimePoint& outPts, Frame* pOutFrame = nullptr){
+    return visit(index, [&](const TimePoint& pts, const Frame& frame){
+      outPts = pts;
+      if( pOutFrame ){
+        *pOutFrame = frame;
+      }
+    });
+  }
+
+  bool empty(){
+    return mHead.load(std::memory_order_acquire) >= mTail.load(std::memory_order_acquire);
+  }
+
+  // binary search on [head, tail) since the PTS is increasing with the index
+  int64_t lowerBound(const TimePoint& nPTS, int64_t tail){
+    TimePoint pts;
+    int64_t low = mHead.load(std::memory_order_acquire);
+    int64_t high = tail;
+    while( low < high ){
+      int64_t mid = low + (high - low) / 2;
+      if( read(mid, pts) ){
+        if( pts < nPTS ){
+          low = mid + 1;
+        } else {
+          high = mid;
+        }
+      } else if( mSlots[mid % mCapacity].index.load(std::memory_order_acquire) > mid ){
+        low = mid + 1; // already overwritten by the newer frame
       } else {
-        bool found = false;
-        for(auto& frame: mFrames){
-          if(frame.first>=nPTS){
-            result = frame.second;
-            found = true;
+        high = mid; // not published yet
+      }
+    }
+    return low;
+  }
+
+  int64_t findFirstIndex(const TimePoint& nPTS){
+    return lowerBound(nPTS, mTail.load(std::memory_order_acquire));
+  }
+
+  // visit the first frame at or after nPTS in place. false if there is no such frame
+  template<typename Visitor> bool visitFirst(const TimePoint& nPTS, Visitor visitor){
+    const int64_t tail = mTail.load(std::memory_order_acquire);
+    // the found slot might be overwritten or not published in the meantime
+    for(int64_t i = lowerBound(nPTS, tail); i < tail; i++){
+      bool isFound = false;
+      visit(i, [&](const TimePoint& pts, const Frame& frame){
+        if( pts >= nPTS ){
+          visitor(pts, frame);
+          isFound = true;
+        }
+      });
+      if( isFound ){
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool findFirst(const TimePoint& nPTS, Frame* pOutFrame = nullptr){
+    return visitFirst(nPTS, [&](const TimePoint&, const Frame& frame){
+      if( pOutFrame ){
+        *pOutFrame = frame;
+      }
+    });
+  }
+
+  // visit the frames from the first frame at or after nPTS until the visitor returns false
+  template<typename Visitor> void visitFrom(const TimePoint& nPTS, Visitor visitor){
+    const int64_t tail = mTail.load(std::memory_order_acquire);
+    bool isContinue = true;
+    for(int64_t i = lowerBound(nPTS, tail); isContinue && i < tail; i++){
+      visit(i, [&](const TimePoint& pts, const Frame& frame){
+        if( pts >= nPTS ){
+          isContinue = visitor(pts, frame);
+        }
+      });
+    }
+  }
+};
+
+enum class FrameReadStatus : uint8_t
+{
+  OK,          // all of the requested range is read
+  END_OF_DATA  // the buffer doesn't have the frames until the end of the range yet
+};
+
+enum class FrameRateConversion : uint8_t
+{
+  NEAREST,        // the frame nearest to the output PTS
+  DROP_DUPLICATE, // the latest frame at or before the output PTS (sample and hold)
+  BLEND           // blend the frames before and after the output PTS by the blender
+};
+
+// lock-free log2 histogram of the durations. bucket 0 : < 1usec, bucket n : [2^(n-1), 2^n) usec
+class FrameLatencyHistogram
+{
+public:
+  static constexpr int BUCKET_COUNT = 32;
+
+  struct Snapshot
+  {
+    std::array<int64_t, BUCKET_COUNT> counts{};
+    int64_t count = 0;
+    std::chrono::nanoseconds total{0};
+    std::chrono::nanoseconds max{0};
+
+    std::chrono::nanoseconds getAverage() const {
+      return count ? total / count : std::chrono::nanoseconds(0);
+    }
+
+    // the upper bound of the bucket which includes the percentile (0.0-1.0)
+    std::chrono::microseconds getPercentile(double percentile) const {
+      int64_t threshold = (int64_t)std::ceil(count * percentile);
+      int64_t accumulated = 0;
+      for(int i = 0; i < BUCKET_COUNT; i++){
+        accumulated += counts[i];
+        if( accumulated >= threshold && accumulated ){
+          return std::chrono::microseconds(1LL << i);
+        }
+      }
+      return std::chrono::microseconds(0);
+    }
+  };
+
+protected:
+  std::array<std::atomic<int64_t>, BUCKET_COUNT> mCounts{};
+  std::atomic<int64_t> mTotal{0};
+  std::atomic<int64_t> mMax{0};
+
+public:
+  void record(std::chrono::nanoseconds duration){
+    int64_t nsec = std::max<int64_t>(0, duration.count());
+    int bucket = std::min<int>(BUCKET_COUNT - 1, std::bit_width((uint64_t)nsec / 1000));
+    mCounts[bucket].fetch_add(1, std::memory_order_relaxed);
+    mTotal.fetch_add(nsec, std::memory_order_relaxed);
+    int64_t max = mMax.load(std::memory_order_relaxed);
+    while( nsec > max && !mMax.compare_exchange_weak(max, nsec, std::memory_order_relaxed) );
+  }
+
+  Snapshot getSnapshot() const {
+    Snapshot result;
+    for(int i = 0; i < BUCKET_COUNT; i++){
+      result.counts[i] = mCounts[i].load(std::memory_order_relaxed);
+      result.count += result.counts[i];
+    }
+    result.total = std::chrono::nanoseconds(mTotal.load(std::memory_order_relaxed));
+    result.max = std::chrono::nanoseconds(mMax.load(std::memory_order_relaxed));
+    return result;
+  }
+
+  void reset(){
+    for(auto& count : mCounts){
+      count.store(0, std::memory_order_relaxed);
+    }
+    mTotal.store(0, std::memory_order_relaxed);
+    mMax.store(0, std::memory_order_relaxed);
+  }
+};
+
+struct VectorFrameStoragePolicy
+{
+  template<typename Frame, typename TimePoint> using Storage = TVectorFrameStorage<Frame, TimePoint>;
+};
+
+struct RingFrameStoragePolicy
+{
+  template<typename Frame, typename TimePoint> using Storage = TRingFrameStorage<Frame, TimePoint>;
+};
+
+
+// Clock : steady_clock by default not to reorder the frames by the wall-clock jump
+template<typename Frame, typename StoragePolicy = VectorFrameStoragePolicy, typename Clock = std::chrono::steady_clock> class TSharedFrameBuffer
+{
+public:
+  using TimePoint = typename Clock::time_point;
+  using Storage = typename StoragePolicy::template Storage<Frame, TimePoint>;
+
+  struct CursorStat
+  {
+    std::string name;
+    int64_t position;     // the next frame index to read
+    int64_t lag;          // the number of frames between the cursor and the newest frame
+    int64_t maxLag;
+    int64_t readCount;
+    int64_t droppedCount; // the frames reclaimed before the cursor read them
+  };
+
+  // snapshot of the instrumentation counters. The counters are updated without the lock then they're not consistent each other strictly.
+  struct BufferStat
+  {
+    int64_t enqueuedCount;
+    int64_t trimmedCount;       // the frames reclaimed by storingSize or the cursors
+    int64_t ptsMissCount;       // dequeueFrame(nPTS) didn't find the frame
+    int64_t feedAheadCount;     // the producer enqueued ahead of the frame rate
+    int64_t reanchorCount;
+    int64_t lockContendedCount; // the buffer lock was held by another thread
+    FrameLatencyHistogram::Snapshot lockWait;       // only the contended lock
+    FrameLatencyHistogram::Snapshot dequeueLatency; // from the PTS to the read
+  };
+
+  // consumer's read position. The buffer keeps the frames until all of the opened cursors passed.
+  // The cursor is used by one consumer thread and it's closed when the last reference is released.
+  class Cursor
+  {
+  protected:
+    TSharedFrameBuffer& mBuffer;
+    const std::string mName;
+    std::atomic<int64_t> mPosition;
+    std::atomic<int64_t> mMaxLag;
+    std::atomic<int64_t> mReadCount;
+    std::atomic<int64_t> mDroppedCount;
+
+    friend class TSharedFrameBuffer;
+
+  public:
+    Cursor(TSharedFrameBuffer& buffer, std::string name, int64_t position):mBuffer(buffer), mName(name), mPosition(position), mMaxLag(0), mReadCount(0), mDroppedCount(0){
+    }
+    // the frames kept for this cursor are released
+    virtual ~Cursor(){
+      mBuffer.updateSlowestCursorPosition();
+    }
+
+    // visit the next frame in place by visitor(const Frame&) and advance the cursor. END_OF_DATA if the producer doesn't enqueue the next frame yet.
+    // The visitor shouldn't keep the reference. The shared memory storage validates the frame after the visit,
+    // then the frame overwritten during the visit is counted as dropped and the visitor is called again with the next frame.
+    template<typename Visitor> FrameReadStatus visit(Visitor visitor){
+      return mBuffer.visitByCursor(*this, visitor);
+    }
+
+    // wait for the next frame up to timeout, then visit it. END_OF_DATA if timeout.
+    template<typename Visitor> FrameReadStatus visit(Visitor visitor, std::chrono::milliseconds timeout){
+      mBuffer.waitUntil(timeout, [&](){
+        auto lock = mBuffer.lockIfNeeded();
+        return mPosition.load(std::memory_order_acquire) < mBuffer.mFrames.getTailIndex();
+      });
+      return mBuffer.visitByCursor(*this, visitor);
+    }
+
+    // read the next frame and advance the cursor. END_OF_DATA if the producer doesn't enqueue the next frame yet.
+    FrameReadStatus read(Frame& outFrame){
+      return visit([&](const Frame& frame){
+        outFrame = frame;
+      });
+    }
+
+    // wait for the next frame up to timeout. END_OF_DATA if timeout.
+    FrameReadStatus read(Frame& outFrame, std::chrono::milliseconds timeout){
+      return visit([&](const Frame& frame){
+        outFrame = frame;
+      }, timeout);
+    }
+
+    // move the cursor to the first frame at or after nPTS
+    void seek(TimePoint nPTS){
+      mBuffer.seekCursor(*this, nPTS);
+    }
+
+    int64_t getLag(){
+      auto lock = mBuffer.lockIfNeeded();
+      return std::max<int64_t>(0, mBuffer.mFrames.getTailIndex() - mPosition.load(std::memory_order_acquire));
+    }
+
+    CursorStat getStat(){
+      return CursorStat{ mName, mPosition.load(std::memory_order_acquire), getLag(), mMaxLag.load(std::memory_order_relaxed), mReadCount.load(std::memory_order_relaxed), mDroppedCount.load(std::memory_order_relaxed) };
+    }
+  };
+
+  // convert the frame rate for the sinks of the other rates such as 240fps to 30/60/120fps.
+  // The frames are visited once per read() for all of the sinks instead of looking up each output PTS.
+  // The converter is used by one consumer thread.
+  class RateConverter
+  {
+  public:
+    // ratio is 0.0 at before and 1.0 at after
+    typedef std::function<Frame(const Frame& before, const Frame& after, double ratio)> BLENDER;
+
+  protected:
+    struct Sink
+    {
+      int64_t rateNum;
+      int64_t rateDen;
+      int64_t outputIndex;
+      TimePoint nextPTS;
+      bool isPrevStored;
+      TimePoint prevPts;
+      Frame prevFrame;
+    };
+
+    TSharedFrameBuffer& mBuffer;
+    TimePoint mStartPTS;
+    bool mIsAnchored;
+    const FrameRateConversion mMode;
+    BLENDER mBlender;
+    std::vector<Sink> mSinks;
+
+    TimePoint getOutputPts(const Sink& sink, int64_t index){
+      int64_t total = index * sink.rateDen;
+      auto duration = std::chrono::seconds(total / sink.rateNum) + std::chrono::nanoseconds((total % sink.rateNum) * 1000000000LL / sink.rateNum);
+      return mStartPTS + std::chrono::duration_cast<typename Clock::duration>(duration);
+    }
+
+    // pts is the first frame at or after sink.nextPTS. The previous frame is before sink.nextPTS if it's stored.
+    void convert(Sink& sink, std::vector<Frame>& outFrames, const TimePoint& pts, const Frame& frame){
+      if( pts == sink.nextPTS || !sink.isPrevStored ){
+        outFrames.push_back(frame);
+        return;
+      }
+      switch( mMode ){
+        case FrameRateConversion::DROP_DUPLICATE:
+          outFrames.push_back(sink.prevFrame);
+          break;
+        case FrameRateConversion::BLEND:
+          if( mBlender ){
+            outFrames.push_back( mBlender(sink.prevFrame, frame, (double)(sink.nextPTS - sink.prevPts).count() / (double)(pts - sink.prevPts).count()) );
             break;
           }
+          [[fallthrough]];
+        case FrameRateConversion::NEAREST:
+          outFrames.push_back( ( sink.nextPTS - sink.prevPts <= pts - sink.nextPTS ) ? sink.prevFrame : frame );
+          break;
+      }
+    }
+
+    // anchor the output PTS to the oldest frame if startPTS isn't specified. false while the buffer is empty.
+    bool anchor(){
+      if( !mIsAnchored ){
+        mBuffer.visitFramesFrom(TimePoint(), [&](const TimePoint& pts, const Frame&){
+          mStartPTS = pts;
+          mIsAnchored = true;
+          return false;
+        });
+        if( mIsAnchored ){
+          for(auto& sink : mSinks){
+            sink.nextPTS = mStartPTS;
+          }
         }
-        if( !found ){
-          throw std::invalid_argument("wrong pts");;
+      }
+      return mIsAnchored;
+    }
+
+  public:
+    RateConverter(TSharedFrameBuffer& buffer, TimePoint startPTS, FrameRateConversion mode, BLENDER blender):mBuffer(buffer), mStartPTS(startPTS), mIsAnchored(startPTS != TimePoint()), mMode(mode), mBlender(blender){
+      anchor();
+    }
+    virtual ~RateConverter(){
+    }
+
+    // add the sink of rateNum/rateDen fps. Returns the index of the sink for read().
+    int addSink(int64_t rateNum, int64_t rateDen = 1){
+      Sink sink{ rateNum, rateDen, 0, mStartPTS, false, TimePoint(), Frame{} };
+      mSinks.push_back( sink );
+      return mSinks.size() - 1;
+    }
+
+    // read the frames of all the sinks until endPTS. outFrames[i] is for the sink i.
+    // END_OF_DATA if the buffer doesn't have the frames until endPTS yet. The next read() continues from there.
+    FrameReadStatus read(std::vector<std::vector<Frame>>& outFrames, TimePoint endPTS){
+      outFrames.resize(mSinks.size());
+      for(auto& frames : outFrames){
+        frames.clear();
+      }
+      if( mSinks.empty() ){
+        return FrameReadStatus::OK;
+      }
+      if( !anchor() ){
+        return FrameReadStatus::END_OF_DATA;
+      }
+      // look back one frame for the frame before the output PTS
+      const auto sourceDuration = std::chrono::duration_cast<typename Clock::duration>(mBuffer.getFrameDuration());
+      TimePoint startPTS = mSinks[0].nextPTS;
+      for(auto& sink : mSinks){
+        startPTS = std::min(startPTS, sink.nextPTS);
+        sink.isPrevStored = false;
+      }
+      size_t pendingSinks = 0;
+      for(auto& sink : mSinks){
+        pendingSinks += ( sink.nextPTS < endPTS ) ? 1 : 0;
+      }
+      if( pendingSinks ){
+        mBuffer.visitFramesFrom(startPTS - sourceDuration, [&](const TimePoint& pts, const Frame& frame){
+          for(size_t i = 0; i < mSinks.size(); i++){
+            Sink& sink = mSinks[i];
+            if( !( sink.nextPTS < endPTS ) ){
+              continue;
+            }
+            while( sink.nextPTS < endPTS && pts >= sink.nextPTS ){
+              convert(sink, outFrames[i], pts, frame);
+              sink.nextPTS = getOutputPts(sink, ++sink.outputIndex);
+            }
+            if( !( sink.nextPTS < endPTS ) ){
+              pendingSinks--;
+              continue;
+            }
+            // copy the frame only if the next output PTS might be before the next frame
+            sink.prevPts = pts;
+            sink.isPrevStored = ( sink.nextPTS < pts + sourceDuration * 2 );
+            if( sink.isPrevStored ){
+              sink.prevFrame = frame;
+            }
+          }
+          return pendingSinks > 0;
+        });
+      }
+      return pendingSinks ? FrameReadStatus::END_OF_DATA : FrameReadStatus::OK;
+    }
+
+    // read the frames of the sink 0
+    FrameReadStatus read(std::vector<Frame>& outFrames, TimePoint endPTS){
+      std::vector<std::vector<Frame>> frames;
+      FrameReadStatus result = read(frames, endPTS);
+      outFrames = std::move(frames[0]);
+      return result;
+    }
+
+    // the epoch until the first frame is enqueued if startPTS isn't specified
+    TimePoint getNextPTS(int sinkIndex = 0){
+      anchor();
+      return mSinks[sinkIndex].nextPTS;
+    }
+  };
+
+protected:
+  float mSamplingRatePerSecond;
+  Storage mFrames;
+  std::atomic<int64_t> mFramePos;
+  int mStoringSize;
+  std::mutex mMutex;
+  // the PTS clock. Immutable once published then the producer reads it without any lock.
+  // PTS = anchorTime + (index - anchorIndex) * rateDen / rateNum [sec]
+  struct FrameClock
+  {
+    TimePoint anchorTime;
+    int64_t anchorIndex;
+    int64_t rateNum;
+    int64_t rateDen;
+    std::chrono::nanoseconds driftTolerance;
+
+    // the duration of the frames by the rational frame rate without accumulating the rounding error
+    std::chrono::nanoseconds getDurationByFrames(int64_t frames) const {
+      int64_t total = frames * rateDen;
+      return std::chrono::seconds(total / rateNum) + std::chrono::nanoseconds((total % rateNum) * 1000000000LL / rateNum);
+    }
+
+    TimePoint getPtsByIndex(int64_t index) const {
+      return anchorTime + std::chrono::duration_cast<typename Clock::duration>(getDurationByFrames(index - anchorIndex));
+    }
+  };
+  std::atomic<std::shared_ptr<const FrameClock>> mClock;
+  std::atomic<int64_t> mReanchorCount;
+  std::vector<std::weak_ptr<Cursor>> mCursors;
+  std::atomic<int64_t> mSlowestCursorPosition; // -1 if no cursor is opened. Published by the consumers then the producer doesn't take mCursorMutex.
+  std::mutex mCursorMutex; // only for mCursors. Not held while accessing the frames.
+  std::mutex mWaitMutex;   // only for the waiters. The producer takes this only when someone waits.
+  std::condition_variable mFrameCondition;
+  std::atomic<int> mWaiterCount;
+  std::atomic<int64_t> mEnqueuedCount;
+  std::atomic<int64_t> mTrimmedCount;
+  std::atomic<int64_t> mPtsMissCount;
+  std::atomic<int64_t> mFeedAheadCount;
+  std::atomic<int64_t> mLockContendedCount;
+  FrameLatencyHistogram mLockWaitHistogram;
+  FrameLatencyHistogram mDequeueLatencyHistogram;
+
+  // the lock-free storage doesn't need the buffer-wide lock.
+  // The wait time is measured only when the lock is contended not to read the clock in the common case.
+  std::unique_lock<std::mutex> lockIfNeeded(){
+    if constexpr (Storage::IS_LOCK_FREE){
+      return std::unique_lock<std::mutex>(mMutex, std::defer_lock);
+    } else {
+      std::unique_lock<std::mutex> lock(mMutex, std::try_to_lock);
+      if( !lock.owns_lock() ){
+        auto start = std::chrono::steady_clock::now();
+        lock.lock();
+        mLockWaitHistogram.record(std::chrono::steady_clock::now() - start);
+        mLockContendedCount.fetch_add(1, std::memory_order_relaxed);
+      }
+      return lock;
+    }
+  }
+
+  void recordDequeueLatency(const TimePoint& now, const TimePoint& pts){
+    mDequeueLatencyHistogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - pts));
+  }
+
+  // swap the clock with the copy modified by func. Retried if the other thread swapped it meanwhile.
+  template <typename FUNC> void updateClock(FUNC func){
+    auto pClock = mClock.load(std::memory_order_acquire);
+    std::shared_ptr<FrameClock> pNewClock;
+    do {
+      pNewClock = std::make_shared<FrameClock>(*pClock);
+      func(*pNewClock);
+    } while( !mClock.compare_exchange_weak(pClock, pNewClock, std::memory_order_acq_rel) );
+  }
+
+  // claim the indexes of the frames and anchor the PTS of the first frame.
+  // Re-anchor to now only if the producer stalled and is behind the expected PTS more than the drift tolerance.
+  // The early producer stays on the rational grid since the batch is enqueued ahead of the frame rate.
+  // The re-anchor swaps the clock by CAS then the concurrent producers of the lock-free storage might stamp
+  // the frames claimed during the swap on the previous grid. It's only on the stall.
+  std::shared_ptr<const FrameClock> claimFrames(size_t count, int64_t& outPos){
+    auto now = Clock::now();
+    outPos = mFramePos.fetch_add(count);
+    auto pClock = mClock.load(std::memory_order_acquire);
+    TimePoint expected = pClock->getPtsByIndex(outPos);
+    if( now < expected ){
+      mFeedAheadCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    while( pClock->driftTolerance.count() && outPos && now > expected + pClock->driftTolerance ){
+      auto pNewClock = std::make_shared<FrameClock>(*pClock);
+      pNewClock->anchorTime = now;
+      pNewClock->anchorIndex = outPos;
+      if( mClock.compare_exchange_weak(pClock, pNewClock, std::memory_order_acq_rel) ){
+        mReanchorCount.fetch_add(1, std::memory_order_relaxed);
+        pClock = std::move(pNewClock);
+        break;
+      }
+      expected = pClock->getPtsByIndex(outPos);
+    }
+    return pClock;
+  }
+
+  template<typename Frames> void enqueueFramesImpl(Frames&& frames){
+    auto lock = lockIfNeeded();
+    int64_t pos;
+    auto pClock = claimFrames(frames.size(), pos);
+    const int64_t head = mFrames.getHeadIndex();
+    for(auto& frame : frames){
+      TimePoint pts = pClock->getPtsByIndex(pos);
+      if constexpr (std::is_rvalue_reference_v<Frames&&>){
+        mFrames.push(pos, pts, std::move(frame));
+      } else {
+        mFrames.push(pos, pts, frame);
+      }
+      pos++;
+    }
+    mFrames.trim();
+    const int64_t slowest = mSlowestCursorPosition.load(std::memory_order_acquire);
+    if( slowest >= 0 ){
+      mFrames.trimBefore(slowest);
+    }
+    mEnqueuedCount.fetch_add(frames.size(), std::memory_order_relaxed);
+    mTrimmedCount.fetch_add(mFrames.getHeadIndex() - head, std::memory_order_relaxed);
+    if( lock.owns_lock() ){
+      lock.unlock();
+    }
+    notifyWaiters();
+  }
+
+  void notifyWaiters(){
+    if( mWaiterCount.load() ){
+      // taking the lock ensures the waiter is either before checking the predicate or already waiting
+      { std::lock_guard<std::mutex> lock(mWaitMutex); }
+      mFrameCondition.notify_all();
+    }
+  }
+
+  template<typename Predicate> bool waitUntil(std::chrono::milliseconds timeout, Predicate predicate){
+    mWaiterCount.fetch_add(1);
+    bool result;
+    {
+      std::unique_lock<std::mutex> lock(mWaitMutex);
+      result = mFrameCondition.wait_for(lock, timeout, predicate);
+    }
+    mWaiterCount.fetch_sub(1);
+    return result;
+  }
+
+  // publish the slowest cursor position. Called by the consumer side when the slowest one might be changed.
+  void updateSlowestCursorPosition(){
+    std::lock_guard<std::mutex> lock(mCursorMutex);
+    int64_t result = -1;
+    std::erase_if(mCursors, [](const std::weak_ptr<Cursor>& pWeakCursor){
+      return pWeakCursor.expired();
+    });
+    for(auto& pWeakCursor : mCursors){
+      auto pCursor = pWeakCursor.lock();
+      if( pCursor ){
+        int64_t position = pCursor->mPosition.load(std::memory_order_acquire);
+        result = (result < 0) ? position : std::min(result, position);
+      }
+    }
+    mSlowestCursorPosition.store(result, std::memory_order_release);
+  }
+
+  template<typename Visitor> FrameReadStatus visitByCursor(Cursor& cursor, Visitor& visitor){
+    auto lock = lockIfNeeded();
+    const int64_t prevPosition = cursor.mPosition.load(std::memory_order_relaxed);
+    int64_t position = prevPosition;
+    const int64_t tail = mFrames.getTailIndex();
+    cursor.mMaxLag.store(std::max(cursor.mMaxLag.load(std::memory_order_relaxed), tail - position), std::memory_order_relaxed);
+    FrameReadStatus result = FrameReadStatus::END_OF_DATA;
+    TimePoint pts;
+    while( position < tail ){
+      int64_t head = mFrames.getHeadIndex();
+      if( position < head ){
+        cursor.mDroppedCount.fetch_add(head - position, std::memory_order_relaxed);
+        position = head;
+      } else if( mFrames.visit(position, [&](const TimePoint& framePts, const Frame& frame){
+          pts = framePts;
+          visitor(frame);
+        }) ){
+        recordDequeueLatency(Clock::now(), pts);
+        position++;
+        cursor.mReadCount.fetch_add(1, std::memory_order_relaxed);
+        result = FrameReadStatus::OK;
+        break;
+      } else if( position >= mFrames.getHeadIndex() ){
+        break; // not published yet
+      }
+    }
+    cursor.mPosition.store(position, std::memory_order_release);
+    // the read only moves forward then only the slowest cursor can change the slowest position
+    if( position != prevPosition && prevPosition <= mSlowestCursorPosition.load(std::memory_order_acquire) ){
+      updateSlowestCursorPosition();
+    }
+    return result;
+  }
+
+  template<typename Visitor> void visitFramesFrom(const TimePoint& nPTS, Visitor visitor){
+    auto lock = lockIfNeeded();
+    mFrames.visitFrom(nPTS, visitor);
+  }
+
+  void seekCursor(Cursor& cursor, TimePoint nPTS){
+    {
+      auto lock = lockIfNeeded();
+      cursor.mPosition.store(mFrames.findFirstIndex(nPTS), std::memory_order_release);
+    }
+    updateSlowestCursorPosition();
+  }
+
+public:
+  // the frame rate is held as nSamplingRatePerSecond*1001/1001 to express 59.94fps (60000/1001) etc. exactly
+  TSharedFrameBuffer(float nSamplingRatePerSecond=60.0f, int storingSize=0 /* infinite */):mSamplingRatePerSecond(nSamplingRatePerSecond), mFrames(storingSize), mFramePos(0), mStoringSize(storingSize), mReanchorCount(0), mSlowestCursorPosition(-1), mWaiterCount(0), mEnqueuedCount(0), mTrimmedCount(0), mPtsMissCount(0), mFeedAheadCount(0), mLockContendedCount(0){
+    mClock.store(std::make_shared<FrameClock>(FrameClock{Clock::now(), 0, 1, 1, std::chrono::nanoseconds(0)}));
+    setFrameRate(std::llround(nSamplingRatePerSecond * 1001.0), 1001);
+    setDriftTolerance(getFrameDuration() * 2);
+  }
+
+  virtual ~TSharedFrameBuffer(){
+
+  }
+
+  // set the frame rate as rateNum/rateDen frames per second such as 30000/1001
+  void setFrameRate(int64_t rateNum, int64_t rateDen = 1){
+    updateClock([&](FrameClock& clock){
+      int64_t pos = mFramePos.load();
+      clock.anchorTime = clock.getPtsByIndex(pos);
+      clock.anchorIndex = pos;
+      clock.rateNum = rateNum;
+      clock.rateDen = rateDen;
+    });
+    mSamplingRatePerSecond = (float)rateNum / (float)rateDen;
+  }
+
+  // re-anchor the PTS if the producer drifts more than this. 0 disables the drift correction.
+  void setDriftTolerance(std::chrono::nanoseconds tolerance){
+    updateClock([&](FrameClock& clock){
+      clock.driftTolerance = tolerance;
+    });
+  }
+
+  int64_t getReanchorCount(){
+    return mReanchorCount.load(std::memory_order_relaxed);
+  }
+
+  // for the storage specific configuration such as the spill tier
+  Storage& getStorage(){
+    return mFrames;
+  }
+
+  BufferStat getBufferStat(){
+    return BufferStat{
+      mEnqueuedCount.load(std::memory_order_relaxed),
+      mTrimmedCount.load(std::memory_order_relaxed),
+      mPtsMissCount.load(std::memory_order_relaxed),
+      mFeedAheadCount.load(std::memory_order_relaxed),
+      getReanchorCount(),
+      mLockContendedCount.load(std::memory_order_relaxed),
+      mLockWaitHistogram.getSnapshot(),
+      mDequeueLatencyHistogram.getSnapshot()
+    };
+  }
+
+  void resetBufferStat(){
+    mEnqueuedCount.store(0, std::memory_order_relaxed);
+    mTrimmedCount.store(0, std::memory_order_relaxed);
+    mPtsMissCount.store(0, std::memory_order_relaxed);
+    mFeedAheadCount.store(0, std::memory_order_relaxed);
+    mLockContendedCount.store(0, std::memory_order_relaxed);
+    mLockWaitHistogram.reset();
+    mDequeueLatencyHistogram.reset();
+  }
+
+  std::chrono::nanoseconds getFrameDuration(){
+    return mClock.load(std::memory_order_acquire)->getDurationByFrames(1);
+  }
+
+  void enqueueFrames(const std::vector<Frame>& frames){
+    enqueueFramesImpl(frames);
+  }
+
+  // move the frames into the buffer instead of copying them
+  void enqueueFrames(std::vector<Frame>&& frames){
+    enqueueFramesImpl(std::move(frames));
+  }
+
+  // enqueue the frame without the temporary vector. The frame is copied once into the storage.
+  void enqueueFrame(const Frame& frame){
+    enqueueFramesImpl(std::span<const Frame, 1>(&frame, 1));
+  }
+
+  void enqueueFrame(Frame&& frame){
+    enqueueFramesImpl(std::span<Frame, 1>(&frame, 1));
+  }
+
+  // open the cursor from the first frame at or after nPTS. The oldest frame if nPTS isn't specified.
+  // Once a cursor is opened, the frames passed by all of the cursors are reclaimed.
+  // The storingSize is still the upper limit if it's specified.
+  std::shared_ptr<Cursor> openCursor(std::string name = "", TimePoint nPTS = TimePoint()){
+    int64_t position;
+    {
+      auto lock = lockIfNeeded();
+      position = ( nPTS == TimePoint() ) ? mFrames.getHeadIndex() : mFrames.findFirstIndex(nPTS);
+    }
+    auto pCursor = std::make_shared<Cursor>(*this, name, position);
+    {
+      std::lock_guard<std::mutex> lock(mCursorMutex);
+      mCursors.push_back(pCursor);
+    }
+    updateSlowestCursorPosition();
+    return pCursor;
+  }
+
+  // open the rate converter of rateNum/rateDen fps from startPTS. The oldest frame's PTS if startPTS isn't specified
+  // then it's deferred to the first frame if the buffer is empty.
+  // Add the other sinks by RateConverter::addSink() to serve them by the same pass.
+  std::shared_ptr<RateConverter> openRateConverter(
+    int64_t rateNum,
+    int64_t rateDen = 1,
+    FrameRateConversion mode = FrameRateConversion::NEAREST,
+    typename RateConverter::BLENDER blender = nullptr,
+    TimePoint startPTS = TimePoint()){
+    auto pConverter = std::make_shared<RateConverter>(*this, startPTS, mode, blender);
+    pConverter->addSink(rateNum, rateDen);
+    return pConverter;
+  }
+
+  std::vector<CursorStat> getCursorStats(){
+    std::vector<std::shared_ptr<Cursor>> cursors;
+    {
+      std::lock_guard<std::mutex> lock(mCursorMutex);
+      for(auto& pWeakCursor : mCursors){
+        auto pCursor = pWeakCursor.lock();
+        if( pCursor ){
+          cursors.push_back( pCursor );
         }
       }
     }
+    // getStat() takes the buffer lock. Don't take it under mCursorMutex since visitByCursor() calls updateSlowestCursorPosition(),
+    // which takes mCursorMutex under the buffer lock.
+    std::vector<CursorStat> result;
+    for(auto& pCursor : cursors){
+      result.push_back( pCursor->getStat() );
+    }
+    return result;
+  }
+
+  // wait until the frame at or after nPTS is enqueued, then visit it in place by visitor(const Frame&). END_OF_DATA if timeout.
+  // The visitor shouldn't keep the reference. The same as Cursor::visit() for the frame overwritten during the visit.
+  template<typename Visitor> FrameReadStatus waitForFrame(TimePoint nPTS, std::chrono::milliseconds timeout, Visitor visitor){
+    bool found = false;
+    waitUntil(timeout, [&](){
+      auto lock = lockIfNeeded();
+      found = mFrames.visitFirst(nPTS, [&](const TimePoint&, const Frame& frame){
+        visitor(frame);
+      });
+      return found;
+    });
+    return found ? FrameReadStatus::OK : FrameReadStatus::END_OF_DATA;
+  }
+
+  // wait until the frame at or after nPTS is enqueued, then get it. END_OF_DATA if timeout.
+  FrameReadStatus waitForFrame(Frame& outFrame, TimePoint nPTS, std::chrono::milliseconds timeout){
+    return waitForFrame(nPTS, timeout, [&](const Frame& frame){
+      outFrame = frame;
+    });
+  }
+
+  // wait until the frames of [startPTS, endPTS) are enqueued, then read them as readFrames().
+  // END_OF_DATA with the partial frames if timeout.
+  FrameReadStatus waitForFrames(
+    std::vector<Frame>& outFrames,
+    TimePoint startPTS,
+    TimePoint endPTS,
+    std::chrono::milliseconds timeout,
+    std::chrono::nanoseconds duration = std::chrono::nanoseconds(0) /* frame duration */){
+    if( !duration.count() ){
+      duration = getFrameDuration();
+    }
+    if( startPTS < endPTS ){
+      // the PTS of the last step in the range
+      TimePoint lastPTS = startPTS + duration * ((endPTS - startPTS - typename Clock::duration(1)) / duration);
+      waitUntil(timeout, [&](){
+        auto lock = lockIfNeeded();
+        return mFrames.findFirst(lastPTS);
+      });
+    }
+    return readFrames(outFrames, startPTS, endPTS, duration);
+  }
+
+  bool isEmpty(TimePoint nPTS = TimePoint()){
+    auto lock = lockIfNeeded();
+    if( nPTS == TimePoint() ){
+      return mFrames.empty();
+    }
+    return !mFrames.findFirst(nPTS);
+  }
+
+  Frame dequeueFrame(TimePoint nPTS = TimePoint()){
+    auto lock = lockIfNeeded();
+    Frame result{};
+    if( !mFrames.empty() ){
+      // the front frame if nPTS isn't specified since it's the lowest PTS
+      bool found = false;
+      mFrames.visitFrom(nPTS, [&](const TimePoint& pts, const Frame& frame){
+        result = frame;
+        found = true;
+        recordDequeueLatency(Clock::now(), pts);
+        return false;
+      });
+      if( !found && nPTS != TimePoint() ){
+        mPtsMissCount.fetch_add(1, std::memory_order_relaxed);
+        throw std::invalid_argument("wrong pts");;
+      }
+    }
     return result;
   }
 
  std::vector<Frame> dequeueFrames(
-  std::chrono::system_clock::time_point startPTS = std::chrono::system_clock::from_time_t(0), 
-  std::chrono::system_clock::time_point endPTS = std::chrono::system_clock::from_time_t(0), 
-  std::chrono::milliseconds durationMilliSeconds =  
-       std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::duration<double, std::milli>(1000.0f/60.0f))){
+  TimePoint startPTS = TimePoint(), 
+  TimePoint endPTS = TimePoint(), 
+  std::chrono::nanoseconds duration = std::chrono::nanoseconds(0) /* frame duration */){
     std::vector<Frame> result;
-    for(std::chrono::system_clock::time_point pos = startPTS; pos<endPTS; pos=pos+durationMilliSeconds){
-      try {
-        result.push_back( dequeueFrame(pos) );
-      } catch (const std::invalid_argument& e) {
-        break;
+    readFrames(result, startPTS, endPTS, duration);
+    return result;
+  }
+
+  // read the frames of [startPTS, endPTS) by duration step with the single lock and the single lookup.
+  // The frame for each step is the first frame at or after the step's PTS, the same as dequeueFrame(pts).
+  FrameReadStatus readFrames(
+    std::vector<Frame>& outFrames,
+    TimePoint startPTS,
+    TimePoint endPTS,
+    std::chrono::nanoseconds duration = std::chrono::nanoseconds(0) /* frame duration */){
+    if( !duration.count() ){
+      duration = getFrameDuration();
+    }
+    auto lock = lockIfNeeded();
+    outFrames.clear();
+    TimePoint pos = startPTS;
+    if( pos < endPTS ){
+      const TimePoint now = Clock::now();
+      mFrames.visitFrom(startPTS, [&](const TimePoint& pts, const Frame& frame){
+        if( pos < endPTS && pts >= pos ){
+          recordDequeueLatency(now, pts);
+        }
+        while( pos < endPTS && pts >= pos ){
+          outFrames.push_back(frame);
+          pos += std::chrono::duration_cast<typename Clock::duration>(duration);
+        }
+        return pos < endPTS;
+      });
+    }
+    return ( pos < endPTS ) ? FrameReadStatus::END_OF_DATA : FrameReadStatus::OK;
+  }
+
+};
+
+
+// --- frame pool : recycle the frame instead of allocating it per frame
+template<typename Frame> class TFramePool : public std::enable_shared_from_this<TFramePool<Frame>>
+{
+public:
+  typedef std::function<Frame*(void)> ALLOCATOR;
+
+protected:
+  std::vector<std::unique_ptr<Frame>> mFreeFrames;
+  std::mutex mMutex;
+  size_t mMaxPoolSize;
+  ALLOCATOR mAllocator;
+
+  void recycle(Frame* pFrame){
+    std::unique_ptr<Frame> frame(pFrame);
+    std::lock_guard<std::mutex> lock(mMutex);
+    if( mFreeFrames.size() < mMaxPoolSize ){
+      mFreeFrames.push_back(std::move(frame));
+    }
+  }
+
+public:
+  TFramePool(size_t maxPoolSize = 16, ALLOCATOR allocator = nullptr):mMaxPoolSize(maxPoolSize), mAllocator(allocator){
+  }
+  virtual ~TFramePool(){
+  }
+
+  // the frame is kept as is (including its allocated memory) and it goes back to this pool when the last reference is released
+  std::shared_ptr<Frame> acquire(){
+    std::unique_ptr<Frame> pFrame;
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      if( !mFreeFrames.empty() ){
+        pFrame = std::move(mFreeFrames.back());
+        mFreeFrames.pop_back();
       }
     }
-    return result;
+    if( !pFrame ){
+      pFrame.reset( mAllocator ? mAllocator() : new Frame() );
+    }
+    std::weak_ptr<TFramePool<Frame>> pWeakPool = this->shared_from_this();
+    return std::shared_ptr<Frame>(pFrame.release(), [pWeakPool](Frame* pFrame){
+      auto pPool = pWeakPool.lock();
+      if( pPool ){
+        pPool->recycle(pFrame);
+      } else {
+        delete pFrame;
+      }
+    });
+  }
+
+  size_t getPooledCount(){
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mFreeFrames.size();
+  }
+};
+
+
+// --- slot based frame buffer : the producer writes the frame in place and the consumers share the read-only frame
+template<typename Frame, typename StoragePolicy = VectorFrameStoragePolicy, typename Clock = std::chrono::steady_clock> class TSharedFrameSlotBuffer : public TSharedFrameBuffer<std::shared_ptr<const Frame>, StoragePolicy, Clock>
+{
+public:
+  using FrameHandle = std::shared_ptr<const Frame>;
+  using WritableSlot = std::shared_ptr<Frame>;
+  using FramePool = TFramePool<Frame>;
+
+protected:
+  std::shared_ptr<FramePool> mPool;
+
+public:
+  TSharedFrameSlotBuffer(float nSamplingRatePerSecond=60.0f, int storingSize=0 /* infinite */, std::shared_ptr<FramePool> pPool = nullptr):TSharedFrameBuffer<FrameHandle, StoragePolicy, Clock>(nSamplingRatePerSecond, storingSize), mPool(pPool ? pPool : std::make_shared<FramePool>()){
   }
 
+  virtual ~TSharedFrameSlotBuffer(){
+  }
+
+  // get the writable frame from the pool. The previous content might remain.
+  WritableSlot acquireSlot(){
+    return mPool->acquire();
+  }
+
+  // publish the written frame. The slot shouldn't be modified after this.
+  void commitSlot(WritableSlot&& slot){
+    this->enqueueFramesImpl( std::array<FrameHandle, 1>{ FrameHandle(std::move(slot)) } );
+  }
+
+  std::shared_ptr<FramePool> getPool(){
+    return mPool;
+  }
 };
+
+#endif // __SHARED_FRAME_BUFFER_HPP__
@@ -0,0 +1,289 @@
+/*
+  Copyright (C) 2026 hidenorly
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef __SHARED_FRAME_SHM_HPP__
+#define __SHARED_FRAME_SHM_HPP__
+
+#include "SharedFrameBuffer.hpp"
+#include <string>
+#include <atomic>
+#include <new>
+#include <cstring>
+#include <type_traits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+// --- POSIX shared memory storage : one producer process and several consumer processes
+// The producer create()s the shared memory and the consumers attach() it read-only.
+// The ring slots are guarded by the sequence number (seqlock) instead of the process-shared mutex,
+// then the readers never block the producer. The frames are read in place from the mapping.
+// The condition variable of TSharedFrameBuffer doesn't cross the process. The consumer process polls (e.g. Cursor::read()).
+template<typename Frame, typename TimePoint> class TShmFrameStorage
+{
+  static_assert(std::is_trivially_copyable_v<Frame>, "shared memory requires trivially copyable Frame");
+  static_assert(std::atomic<int64_t>::is_always_lock_free, "process-shared index requires lock-free atomic");
+
+public:
+  static constexpr bool IS_LOCK_FREE = true;
+  static constexpr size_t DEFAULT_CAPACITY = 256;
+  static constexpr uint32_t MAGIC = 0x53465348; // "SFSH"
+  static constexpr uint32_t VERSION = 1;
+
+protected:
+  struct Header
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotSize;
+    uint32_t capacity;
+    std::atomic<int64_t> head; // the oldest retained frame index
+    std::atomic<int64_t> tail; // the next frame index
+  };
+
+  struct Slot
+  {
+    std::atomic<int64_t> sequence; // index*2+1 : writing, index*2+2 : published
+    int64_t pts;                   // TimePoint::time_since_epoch().count()
+    Frame frame;
+  };
+
+  std::string mName;
+  size_t mCapacity;
+  bool mIsOwner;
+  void* mpMapped;
+  size_t mMappedSize;
+  Header* mpHeader;
+  Slot* mpSlots;
+
+  static size_t getMappedSize(size_t capacity){
+    return sizeof(Header) + sizeof(Slot) * capacity;
+  }
+
+  bool map(int fd, size_t size, int protection){
+    mpMapped = ::mmap(nullptr, size, protection, MAP_SHARED, fd, 0);
+    if( mpMapped == MAP_FAILED ){
+      mpMapped = nullptr;
+      return false;
+    }
+    mMappedSize = size;
+    mpHeader = reinterpret_cast<Header*>(mpMapped);
+    mpSlots = reinterpret_cast<Slot*>(reinterpret_cast<uint8_t*>(mpMapped) + sizeof(Header));
+    return true;
+  }
+
+  static int64_t toCount(const TimePoint& pts){
+    return pts.time_since_epoch().count();
+  }
+
+  static TimePoint toTimePoint(int64_t count){
+    return TimePoint(typename TimePoint::duration(count));
+  }
+
+public:
+  TShmFrameStorage(size_t storingSize=0 /* DEFAULT_CAPACITY */):mCapacity(storingSize ? storingSize : DEFAULT_CAPACITY), mIsOwner(false), mpMapped(nullptr), mMappedSize(0), mpHeader(nullptr), mpSlots(nullptr){
+  }
+
+  virtual ~TShmFrameStorage(){
+    close();
+  }
+
+  // for the producer process. name is such as "/camera0"
+  bool create(const std::string& name){
+    close();
+    int fd = ::shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if( fd < 0 ) return false;
+    size_t size = getMappedSize(mCapacity);
+    bool result = ( ::ftruncate(fd, size) == 0 ) && map(fd, size, PROT_READ | PROT_WRITE);
+    ::close(fd);
+    if( !result ){
+      ::shm_unlink(name.c_str());
+      return false;
+    }
+    mName = name;
+    mIsOwner = true;
+    mpHeader->magic = MAGIC;
+    mpHeader->version = VERSION;
+    mpHeader->slotSize = sizeof(Slot);
+    mpHeader->capacity = mCapacity;
+    new (&mpHeader->head) std::atomic<int64_t>(0);
+    new (&mpHeader->tail) std::atomic<int64_t>(0);
+    for(size_t i = 0; i < mCapacity; i++){
+      new (&mpSlots[i].sequence) std::atomic<int64_t>(0);
+    }
+    return true;
+  }
+
+  // for the consumer process
+  bool attach(const std::string& name){
+    close();
+    int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if( fd < 0 ) return false;
+    struct stat st;
+    bool result = ( ::fstat(fd, &st) == 0 ) && ( (size_t)st.st_size >= sizeof(Header) ) && map(fd, st.st_size, PROT_READ);
+    ::close(fd);
+    if( result && ( mpHeader->magic != MAGIC || mpHeader->version != VERSION || mpHeader->slotSize != sizeof(Slot)
+      || getMappedSize(mpHeader->capacity) > mMappedSize ) ){
+      result = false;
+    }
+    if( !result ){
+      close();
+      return false;
+    }
+    mName = name;
+    mCapacity = mpHeader->capacity;
+    return true;
+  }
+
+  void close(){
+    if( mpMapped ){
+      ::munmap(mpMapped, mMappedSize);
+      mpMapped = nullptr;
+    }
+    if( mIsOwner ){
+      ::shm_unlink(mName.c_str());
+      mIsOwner = false;
+    }
+    mpHeader = nullptr;
+    mpSlots = nullptr;
+  }
+
+  bool isAttached(){
+    return mpHeader != nullptr;
+  }
+
+  size_t capacity() const {
+    return mCapacity;
+  }
+
+  template<typename TFrame> void push(int64_t index, const TimePoint& pts, TFrame&& frame){
+    if( !mIsOwner ) return;
+    Slot& slot = mpSlots[index % mCapacity];
+    // the slot is invalidated before the head passes it so that the readers can detect the overwrite
+    mpHeader->head.store(std::max<int64_t>(mpHeader->head.load(std::memory_order_relaxed), index+1-(int64_t)mCapacity), std::memory_order_release);
+    slot.sequence.store(index*2+1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.pts = toCount(pts);
+    std::memcpy(&slot.frame, &frame, sizeof(Frame));
+    slot.sequence.store(index*2+2, std::memory_order_release);
+    mpHeader->tail.store(index+1, std::memory_order_release);
+  }
+
+  void trim(){
+    // nothing to do. The head is advanced by push()
+  }
+
+  void trimBefore(int64_t /* index */){
+    // the retention is the ring capacity. The consumer processes' cursors don't reclaim the frames.
+  }
+
+  int64_t getHeadIndex(){
+    return mpHeader ? mpHeader->head.load(std::memory_order_acquire) : 0;
+  }
+
+  int64_t getTailIndex(){
+    return mpHeader ? mpHeader->tail.load(std::memory_order_acquire) : 0;
+  }
+
+  // visit the frame in the shared memory without copying. false if the frame is overwritten during the visit,
+  // then the visitor's result should be discarded.
+  template<typename Visitor> bool visit(int64_t index, Visitor visitor){
+    if( !mpHeader || index < 0 ) return false;
+    Slot& slot = mpSlots[index % mCapacity];
+    const int64_t sequence = slot.sequence.load(std::memory_order_acquire);
+    if( sequence != index*2+2 ){
+      return false;
+    }
+    visitor(toTimePoint(slot.pts), slot.frame);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.sequence.load(std::memory_order_relaxed) == sequence;
+  }
+
+  bool read(int64_t index, TimePoint& outPts, Frame* pOutFrame = nullptr){
+    return visit(index, [&](const TimePoint& pts, const Frame& frame){
+      outPts = pts;
+      if( pOutFrame ){
+        std::memcpy(pOutFrame, &frame, sizeof(Frame));
+      }
+    });
+  }
+
+  bool empty(){
+    return getHeadIndex() >= getTailIndex();
+  }
+
+  int64_t findFirstIndex(const TimePoint& nPTS){
+    TimePoint pts;
+    int64_t low = getHeadIndex();
+    int64_t high = getTailIndex();
+    while( low < high ){
+      int64_t mid = low + (high - low) / 2;
+      if( !read(mid, pts) || pts < nPTS ){
+        low = mid + 1; // the overwritten slot is older than nPTS
+      } else {
+        high = mid;
+      }
+    }
+    return low;
+  }
+
+  // visit the first frame at or after nPTS in place. The frame overwritten during the visit is skipped.
+  template<typename Visitor> bool visitFirst(const TimePoint& nPTS, Visitor visitor){
+    const int64_t tail = getTailIndex();
+    for(int64_t i = findFirstIndex(nPTS); i < tail; i++){
+      bool isFound = false;
+      if( visit(i, [&](const TimePoint& pts, const Frame& frame){
+        if( pts >= nPTS ){
+          visitor(pts, frame);
+          isFound = true;
+        }
+      }) && isFound ){
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool findFirst(const TimePoint& nPTS, Frame* pOutFrame = nullptr){
+    return visitFirst(nPTS, [&](const TimePoint&, const Frame& frame){
+      if( pOutFrame ){
+        std::memcpy(pOutFrame, &frame, sizeof(Frame));
+      }
+    });
+  }
+
+  template<typename Visitor> void visitFrom(const TimePoint& nPTS, Visitor visitor){
+    const int64_t tail = getTailIndex();
+    Frame frame;
+    TimePoint pts;
+    for(int64_t i = findFirstIndex(nPTS); i < tail; i++){
+      // copy out to pass the consistent frame to the visitor which may keep it such as readFrames().
+      // Cursor::visit() and waitForFrame() visit in place instead.
+      if( read(i, pts, &frame) && pts >= nPTS ){
+        if( !visitor(pts, frame) ) break;
+      }
+    }
+  }
+};
+
+struct ShmFrameStoragePolicy
+{
+  template<typename Frame, typename TimePoint> using Storage = TShmFrameStorage<Frame, TimePoint>;
+};
+
+#endif // __SHARED_FRAME_SHM_HPP__
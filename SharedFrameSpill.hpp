@@ -0,0 +1,407 @@
+/*
+  Copyright (C) 2026 hidenorly
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef __SHARED_FRAME_SPILL_HPP__
+#define __SHARED_FRAME_SPILL_HPP__
+
+#include "SharedFrameBuffer.hpp"
+#include <string>
+#include <vector>
+#include <memory>
+#include <filesystem>
+#include <algorithm>
+#include <type_traits>
+#include <cstring>
+#include <cctype>
+#include <charconv>
+#include <cstdio>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+// --- memory-mapped segment file of the spilled frames
+//   [Header][Record 0][Record 1]...[Record capacity-1]
+// The file is sized at the creation (sparse) and the record count in the header is updated after the record is written.
+template<typename Frame> class TFrameSpillSegment
+{
+public:
+  static constexpr uint32_t MAGIC = 0x53465350; // "SFSP"
+  static constexpr uint32_t VERSION = 1;
+
+  struct Header
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t capacity;
+    uint64_t count;
+  };
+
+  struct Record
+  {
+    int64_t index;
+    int64_t pts; // TimePoint::time_since_epoch().count()
+    Frame frame;
+  };
+
+protected:
+  std::string mPath;
+  int mFd;
+  void* mpMapped;
+  size_t mMappedSize;
+  Header* mpHeader;
+  Record* mpRecords;
+
+  static size_t getFileSize(uint32_t capacity){
+    return sizeof(Header) + sizeof(Record) * capacity;
+  }
+
+  bool map(size_t size){
+    mpMapped = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if( mpMapped == MAP_FAILED ){
+      mpMapped = nullptr;
+      return false;
+    }
+    mMappedSize = size;
+    mpHeader = reinterpret_cast<Header*>(mpMapped);
+    mpRecords = reinterpret_cast<Record*>(reinterpret_cast<uint8_t*>(mpMapped) + sizeof(Header));
+    return true;
+  }
+
+public:
+  TFrameSpillSegment():mFd(-1), mpMapped(nullptr), mMappedSize(0), mpHeader(nullptr), mpRecords(nullptr){
+  }
+
+  virtual ~TFrameSpillSegment(){
+    close();
+  }
+
+  // create the new segment file
+  bool create(const std::string& path, uint32_t capacity){
+    close();
+    mPath = path;
+    mFd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if( mFd < 0 ) return false;
+    size_t size = getFileSize(capacity);
+    if( ::ftruncate(mFd, size) != 0 || !map(size) ){
+      close();
+      return false;
+    }
+    mpHeader->magic = MAGIC;
+    mpHeader->version = VERSION;
+    mpHeader->recordSize = sizeof(Record);
+    mpHeader->capacity = capacity;
+    mpHeader->count = 0;
+    return true;
+  }
+
+  // re-map the existing segment file
+  bool open(const std::string& path){
+    close();
+    mPath = path;
+    mFd = ::open(path.c_str(), O_RDWR);
+    if( mFd < 0 ) return false;
+    struct stat st;
+    if( ::fstat(mFd, &st) != 0 || (size_t)st.st_size < sizeof(Header) || !map(st.st_size) ){
+      close();
+      return false;
+    }
+    if( mpHeader->magic != MAGIC || mpHeader->version != VERSION || mpHeader->recordSize != sizeof(Record)
+      || getFileSize(mpHeader->capacity) > mMappedSize || mpHeader->count > mpHeader->capacity ){
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  void close(){
+    if( mpMapped ){
+      ::munmap(mpMapped, mMappedSize);
+      mpMapped = nullptr;
+    }
+    if( mFd >= 0 ){
+      ::close(mFd);
+      mFd = -1;
+    }
+    mpHeader = nullptr;
+    mpRecords = nullptr;
+  }
+
+  bool isFull(){
+    return !mpHeader || mpHeader->count >= mpHeader->capacity;
+  }
+
+  bool append(int64_t index, int64_t pts, const Frame& frame){
+    if( isFull() ) return false;
+    Record& record = mpRecords[mpHeader->count];
+    record.index = index;
+    record.pts = pts;
+    std::memcpy(&record.frame, &frame, sizeof(Frame));
+    mpHeader->count++;
+    return true;
+  }
+
+  size_t size(){
+    return mpHeader ? mpHeader->count : 0;
+  }
+
+  const Record& at(size_t n){
+    return mpRecords[n];
+  }
+
+  // the first record position at or after the pts
+  size_t lowerBound(int64_t pts){
+    const Record* pBegin = mpRecords;
+    const Record* pEnd = mpRecords + size();
+    return std::lower_bound(pBegin, pEnd, pts, [](const Record& record, int64_t pts){
+      return record.pts < pts;
+    }) - pBegin;
+  }
+
+  void sync(){
+    if( mpMapped ){
+      ::msync(mpMapped, mMappedSize, MS_ASYNC);
+    }
+  }
+
+  const std::string& getPath(){
+    return mPath;
+  }
+};
+
+
+// --- spill storage : the hot frames are on the heap and the frames older than the hot window go to the segment files.
+// The PTS lookup (findFirst, visitFrom) covers both tiers. The index based access (cursor) covers the hot tier.
+// Call open() to enable the spill tier. Without it, the evicted frames are dropped as the vector storage.
+// Note that the PTS of the re-mapped segments are comparable only if the clock's epoch survives the restart such as system_clock.
+template<typename Frame, typename TimePoint> class TSpillFrameStorage
+{
+  static_assert(std::is_trivially_copyable_v<Frame>, "spill tier requires trivially copyable Frame");
+
+public:
+  static constexpr bool IS_LOCK_FREE = false;
+  static constexpr uint32_t DEFAULT_SEGMENT_CAPACITY = 65536;
+
+  using Segment = TFrameSpillSegment<Frame>;
+
+protected:
+  TVectorFrameStorage<Frame, TimePoint> mHot;
+  size_t mHotSize;
+  std::string mDirectory;
+  uint32_t mSegmentCapacity;
+  size_t mMaxSegments;
+  std::vector<std::unique_ptr<Segment>> mSegments;
+  int64_t mNextSegmentId;
+
+  static int64_t toCount(const TimePoint& pts){
+    return pts.time_since_epoch().count();
+  }
+
+  static TimePoint toTimePoint(int64_t count){
+    return TimePoint(typename TimePoint::duration(count));
+  }
+
+  std::string getSegmentPath(int64_t id){
+    char name[32];
+    std::snprintf(name, sizeof(name), "segment_%012lld.bin", (long long)id);
+    return (std::filesystem::path(mDirectory) / name).string();
+  }
+
+  Segment* getWritableSegment(){
+    if( mSegments.empty() || mSegments.back()->isFull() ){
+      auto pSegment = std::make_unique<Segment>();
+      if( !pSegment->create(getSegmentPath(mNextSegmentId), mSegmentCapacity) ){
+        return nullptr;
+      }
+      mNextSegmentId++;
+      mSegments.push_back(std::move(pSegment));
+      if( mMaxSegments && mSegments.size() > mMaxSegments ){
+        std::string path = mSegments.front()->getPath();
+        mSegments.erase(mSegments.begin());
+        std::filesystem::remove(path);
+      }
+    }
+    return mSegments.back().get();
+  }
+
+  void spill(int64_t index, const TimePoint& pts, const Frame& frame){
+    if( !mDirectory.empty() ){
+      Segment* pSegment = getWritableSegment();
+      if( pSegment ){
+        pSegment->append(index, toCount(pts), frame);
+      }
+    }
+  }
+
+  // visit the spilled frames from the first frame at or after nPTS. false if the visitor stops.
+  template<typename Visitor> bool visitSpilledFrom(const TimePoint& nPTS, Visitor& visitor){
+    int64_t pts = toCount(nPTS);
+    // the first segment which may have the frame at or after the pts
+    auto it = std::lower_bound(mSegments.begin(), mSegments.end(), pts, [](const std::unique_ptr<Segment>& pSegment, int64_t pts){
+      return pSegment->size() && pSegment->at(pSegment->size()-1).pts < pts;
+    });
+    for( ; it != mSegments.end(); it++ ){
+      Segment& segment = **it;
+      for(size_t n = segment.lowerBound(pts); n < segment.size(); n++){
+        auto& record = segment.at(n);
+        if( !visitor(toTimePoint(record.pts), record.frame) ){
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+public:
+  TSpillFrameStorage(size_t storingSize=0 /* hot window. infinite */):mHot(0), mHotSize(storingSize), mSegmentCapacity(DEFAULT_SEGMENT_CAPACITY), mMaxSegments(0), mNextSegmentId(0){
+  }
+
+  virtual ~TSpillFrameStorage(){
+    for(auto& pSegment : mSegments){
+      pSegment->sync();
+    }
+  }
+
+  // enable the spill tier on the directory and re-map the existing segments there
+  bool open(const std::string& directory, uint32_t segmentCapacity = DEFAULT_SEGMENT_CAPACITY, size_t maxSegments = 0 /* infinite */){
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if( !std::filesystem::is_directory(directory) ){
+      return false;
+    }
+    mDirectory = directory;
+    mSegmentCapacity = segmentCapacity;
+    mMaxSegments = maxSegments;
+    mSegments.clear();
+
+    // the segment id and the path. The names whose id isn't all digits aren't the segments.
+    std::vector<std::pair<int64_t, std::string>> paths;
+    for(auto& entry : std::filesystem::directory_iterator(directory)){
+      std::string name = entry.path().filename().string();
+      if( name.starts_with("segment_") && name.ends_with(".bin") ){
+        const char* pIdBegin = name.data() + 8;
+        const char* pIdEnd = name.data() + name.size() - 4;
+        int64_t id = 0;
+        auto [ptr, error] = std::from_chars(pIdBegin, pIdEnd, id);
+        if( pIdBegin < pIdEnd && std::isdigit((unsigned char)*pIdBegin) && error == std::errc() && ptr == pIdEnd ){
+          paths.push_back( { id, entry.path().string() } );
+        }
+      }
+    }
+    std::sort(paths.begin(), paths.end());
+    for(auto& [id, path] : paths){
+      auto pSegment = std::make_unique<Segment>();
+      if( pSegment->open(path) ){
+        mSegments.push_back(std::move(pSegment));
+      }
+    }
+    if( !paths.empty() ){
+      mNextSegmentId = paths.back().first + 1;
+    }
+    return true;
+  }
+
+  size_t getSpilledCount(){
+    size_t result = 0;
+    for(auto& pSegment : mSegments){
+      result += pSegment->size();
+    }
+    return result;
+  }
+
+  template<typename TFrame> void push(int64_t index, const TimePoint& pts, TFrame&& frame){
+    mHot.push(index, pts, std::forward<TFrame>(frame));
+  }
+
+  void trim(){
+    if( mHotSize && (size_t)(mHot.getTailIndex() - mHot.getHeadIndex()) > mHotSize ){
+      trimBefore(mHot.getTailIndex() - mHotSize);
+    }
+  }
+
+  // move the frames before the index from the hot tier to the spill tier
+  void trimBefore(int64_t index){
+    TimePoint pts;
+    Frame frame;
+    for(int64_t i = mHot.getHeadIndex(); i < index && mHot.read(i, pts, &frame); i++){
+      spill(i, pts, frame);
+    }
+    mHot.trimBefore(index);
+  }
+
+  int64_t getHeadIndex(){
+    return mHot.getHeadIndex();
+  }
+
+  int64_t getTailIndex(){
+    return mHot.getTailIndex();
+  }
+
+  template<typename Visitor> bool visit(int64_t index, Visitor visitor){
+    return mHot.visit(index, visitor);
+  }
+
+  bool read(int64_t index, TimePoint& outPts, Frame* pOutFrame = nullptr){
+    return mHot.read(index, outPts, pOutFrame);
+  }
+
+  bool empty(){
+    return mHot.empty() && !getSpilledCount();
+  }
+
+  int64_t findFirstIndex(const TimePoint& nPTS){
+    return mHot.findFirstIndex(nPTS);
+  }
+
+  template<typename Visitor> bool visitFirst(const TimePoint& nPTS, Visitor visitor){
+    bool found = false;
+    auto spilledVisitor = [&](const TimePoint& pts, const Frame& frame){
+      visitor(pts, frame);
+      found = true;
+      return false;
+    };
+    if( !mSegments.empty() && mHot.findFirstIndex(nPTS) == mHot.getHeadIndex() ){
+      // nPTS might be older than the hot tier
+      visitSpilledFrom(nPTS, spilledVisitor);
+      if( found ) return true;
+    }
+    return mHot.visitFirst(nPTS, visitor);
+  }
+
+  bool findFirst(const TimePoint& nPTS, Frame* pOutFrame = nullptr){
+    return visitFirst(nPTS, [&](const TimePoint&, const Frame& frame){
+      if( pOutFrame ){
+        *pOutFrame = frame;
+      }
+    });
+  }
+
+  template<typename Visitor> void visitFrom(const TimePoint& nPTS, Visitor visitor){
+    if( !mSegments.empty() && mHot.findFirstIndex(nPTS) == mHot.getHeadIndex() ){
+      if( !visitSpilledFrom(nPTS, visitor) ) return;
+    }
+    mHot.visitFrom(nPTS, visitor);
+  }
+};
+
+struct SpillFrameStoragePolicy
+{
+  template<typename Frame, typename TimePoint> using Storage = TSpillFrameStorage<Frame, TimePoint>;
+};
+
+#endif // __SHARED_FRAME_SPILL_HPP__
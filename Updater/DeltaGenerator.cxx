@@ -0,0 +1,69 @@
+/*
+  Copyright (C) 2025 hidenorly
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// clang++ -std=c++20 DeltaGenerator.cxx -o delta_generator
+// ./delta_generator source.img target.img target.delta [blockSize]
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <string>
+
+#define USE_PLUGIN 0
+#include "Updater.hpp"
+
+
+std::vector<uint8_t> readFile(const std::string& path)
+{
+  std::ifstream stream(path, std::ios::binary);
+  if( !stream ){
+    throw InvalidArgumentException( std::string("Can't open ") + path );
+  }
+  return std::vector<uint8_t>( (std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>() );
+}
+
+
+int main(int argc, char** argv)
+{
+  if( argc < 4 ){
+    std::cout << "Usage: " << argv[0] << " source target delta [blockSize]" << std::endl;
+    return 1;
+  }
+
+  try{
+    std::vector<uint8_t> source = readFile(argv[1]);
+    std::vector<uint8_t> target = readFile(argv[2]);
+    uint32_t blockSize = ( argc >= 5 ) ? std::stoul(argv[4]) : 4096;
+
+    UpdateDeltaGenerator::Stat stat;
+    std::vector<uint8_t> delta = UpdateDeltaGenerator::generate(source, target, blockSize, &stat);
+
+    std::ofstream stream(argv[3], std::ios::binary);
+    stream.write(reinterpret_cast<const char*>(delta.data()), delta.size());
+    if( !stream ){
+      throw IllegalStateException( std::string("Can't write ") + argv[3] );
+    }
+
+    std::cout << "target=" << target.size() << " delta=" << delta.size() << " (" << (target.size() ? delta.size() * 100 / target.size() : 0) << "%)";
+    std::cout << " copy=" << stat.copyBlocks << " patch=" << stat.patchBlocks << " data=" << stat.dataBlocks << std::endl;
+  } catch (BaseException& ex){
+    ex.dump();
+    return 1;
+  }
+
+  return 0;
+}
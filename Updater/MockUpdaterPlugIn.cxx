@@ -151,7 +151,8 @@ public:
     return (type == IUpdateSession::UpdateType::FULL);
   }
 
-  virtual bool write(std::string id, std::vector<uint8_t> chunk){
+  using IConcreteUpdateHal::write;
+  virtual bool write(std::string id, std::span<const uint8_t> chunk){
     bool result = false;
     if( mSessions.contains(id) && mSessions[id] ){
       result = mSessions[id]->write(chunk);
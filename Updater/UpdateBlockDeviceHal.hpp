@@ -0,0 +1,610 @@
+/*
+  Copyright (C) 2025 hidenorly
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef __UPDATE_BLOCK_DEVICE_HAL_HPP__
+#define __UPDATE_BLOCK_DEVICE_HAL_HPP__
+
+#include "Updater.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#define UPDATE_IO_URING 1
+#else
+#define UPDATE_IO_URING 0
+#endif
+
+
+// --- minimum io_uring by the system calls (without liburing). isAvailable() is false if the kernel doesn't support it.
+class UpdateIoUring
+{
+public:
+  struct Completion
+  {
+    uint64_t userData;
+    int32_t result;
+  };
+
+protected:
+  int mFd;
+  uint32_t mPendingCount;
+#if UPDATE_IO_URING
+  struct io_uring_params mParams;
+  void* mpSqRing;
+  size_t mSqRingSize;
+  void* mpCqRing;
+  size_t mCqRingSize;
+  struct io_uring_sqe* mpSqes;
+  size_t mSqesSize;
+  uint32_t* mpSqHead;
+  uint32_t* mpSqTail;
+  uint32_t* mpSqArray;
+  uint32_t mSqMask;
+  uint32_t* mpCqHead;
+  uint32_t* mpCqTail;
+  struct io_uring_cqe* mpCqes;
+  uint32_t mCqMask;
+
+  template<typename T> T* getPointer(void* pRing, uint32_t offset){
+    return reinterpret_cast<T*>( reinterpret_cast<uint8_t*>(pRing) + offset );
+  }
+#endif // UPDATE_IO_URING
+
+public:
+  UpdateIoUring():mFd(-1), mPendingCount(0){
+#if UPDATE_IO_URING
+    mpSqRing = mpCqRing = nullptr;
+    mpSqes = nullptr;
+#endif // UPDATE_IO_URING
+  }
+  UpdateIoUring(const UpdateIoUring&) = delete;
+  UpdateIoUring& operator=(const UpdateIoUring&) = delete;
+
+  virtual ~UpdateIoUring(){
+    close();
+  }
+
+  bool open(uint32_t queueDepth){
+    close();
+#if UPDATE_IO_URING
+    std::memset(&mParams, 0, sizeof(mParams));
+    mFd = ::syscall(__NR_io_uring_setup, queueDepth, &mParams);
+    if( mFd < 0 ) return false;
+
+    mSqRingSize = mParams.sq_off.array + mParams.sq_entries * sizeof(uint32_t);
+    mCqRingSize = mParams.cq_off.cqes + mParams.cq_entries * sizeof(struct io_uring_cqe);
+    const bool isSingleMap = mParams.features & IORING_FEAT_SINGLE_MMAP;
+    if( isSingleMap ){
+      mSqRingSize = mCqRingSize = std::max(mSqRingSize, mCqRingSize);
+    }
+    mpSqRing = ::mmap(nullptr, mSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQ_RING);
+    mpCqRing = isSingleMap ? mpSqRing : ::mmap(nullptr, mCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_CQ_RING);
+    mSqesSize = mParams.sq_entries * sizeof(struct io_uring_sqe);
+    void* pSqes = ::mmap(nullptr, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQES);
+    if( mpSqRing == MAP_FAILED || mpCqRing == MAP_FAILED || pSqes == MAP_FAILED ){
+      if( mpSqRing == MAP_FAILED ) mpSqRing = nullptr;
+      if( mpCqRing == MAP_FAILED ) mpCqRing = nullptr;
+      mpSqes = ( pSqes == MAP_FAILED ) ? nullptr : reinterpret_cast<struct io_uring_sqe*>(pSqes);
+      close();
+      return false;
+    }
+    mpSqes = reinterpret_cast<struct io_uring_sqe*>(pSqes);
+    mpSqHead = getPointer<uint32_t>(mpSqRing, mParams.sq_off.head);
+    mpSqTail = getPointer<uint32_t>(mpSqRing, mParams.sq_off.tail);
+    mpSqArray = getPointer<uint32_t>(mpSqRing, mParams.sq_off.array);
+    mSqMask = *getPointer<uint32_t>(mpSqRing, mParams.sq_off.ring_mask);
+    mpCqHead = getPointer<uint32_t>(mpCqRing, mParams.cq_off.head);
+    mpCqTail = getPointer<uint32_t>(mpCqRing, mParams.cq_off.tail);
+    mpCqes = getPointer<struct io_uring_cqe>(mpCqRing, mParams.cq_off.cqes);
+    mCqMask = *getPointer<uint32_t>(mpCqRing, mParams.cq_off.ring_mask);
+    return true;
+#else
+    return false;
+#endif // UPDATE_IO_URING
+  }
+
+  void close(){
+#if UPDATE_IO_URING
+    if( mpSqes ) ::munmap(mpSqes, mSqesSize);
+    if( mpCqRing && mpCqRing != mpSqRing ) ::munmap(mpCqRing, mCqRingSize);
+    if( mpSqRing ) ::munmap(mpSqRing, mSqRingSize);
+    mpSqRing = mpCqRing = nullptr;
+    mpSqes = nullptr;
+#endif // UPDATE_IO_URING
+    if( mFd >= 0 ) ::close(mFd);
+    mFd = -1;
+    mPendingCount = 0;
+  }
+
+  bool isAvailable(){
+    return mFd >= 0;
+  }
+
+  // the buffers are pinned once then prepareWrite() with bufferIndex skips the mapping per I/O
+  bool registerBuffers(const std::vector<struct iovec>& buffers){
+#if UPDATE_IO_URING
+    return isAvailable() && ::syscall(__NR_io_uring_register, mFd, IORING_REGISTER_BUFFERS, buffers.data(), buffers.size()) == 0;
+#else
+    return false;
+#endif // UPDATE_IO_URING
+  }
+
+  // false if the submission queue is full. bufferIndex < 0 for the unregistered buffer.
+  bool prepareWrite(int fd, const void* pBuffer, uint32_t size, uint64_t offset, uint64_t userData, int bufferIndex = -1){
+#if UPDATE_IO_URING
+    struct io_uring_sqe* pSqe = getSqe();
+    if( !pSqe ) return false;
+    pSqe->opcode = ( bufferIndex >= 0 ) ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    pSqe->fd = fd;
+    pSqe->addr = reinterpret_cast<uint64_t>(pBuffer);
+    pSqe->len = size;
+    pSqe->off = offset;
+    pSqe->buf_index = ( bufferIndex >= 0 ) ? bufferIndex : 0;
+    pSqe->user_data = userData;
+    commitSqe();
+    return true;
+#else
+    return false;
+#endif // UPDATE_IO_URING
+  }
+
+  // fdatasync after all of the previous writes are completed
+  bool prepareSync(int fd, uint64_t userData){
+#if UPDATE_IO_URING
+    struct io_uring_sqe* pSqe = getSqe();
+    if( !pSqe ) return false;
+    pSqe->opcode = IORING_OP_FSYNC;
+    pSqe->flags = IOSQE_IO_DRAIN;
+    pSqe->fd = fd;
+    pSqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    pSqe->user_data = userData;
+    commitSqe();
+    return true;
+#else
+    return false;
+#endif // UPDATE_IO_URING
+  }
+
+  // submit the prepared requests and wait for waitCount completions
+  bool submit(uint32_t waitCount = 0){
+#if UPDATE_IO_URING
+    while( mPendingCount || waitCount ){
+      int result = ::syscall(__NR_io_uring_enter, mFd, mPendingCount, waitCount, waitCount ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+      if( result < 0 ){
+        if( errno == EINTR || errno == EAGAIN || errno == EBUSY ) continue;
+        return false;
+      }
+      mPendingCount -= std::min<uint32_t>(result, mPendingCount);
+      if( waitCount ) break;
+    }
+    return true;
+#else
+    return false;
+#endif // UPDATE_IO_URING
+  }
+
+  bool popCompletion(Completion& completion){
+#if UPDATE_IO_URING
+    uint32_t head = *mpCqHead;
+    if( head == std::atomic_ref<uint32_t>(*mpCqTail).load(std::memory_order_acquire) ) return false;
+    struct io_uring_cqe& cqe = mpCqes[head & mCqMask];
+    completion = Completion{ cqe.user_data, cqe.res };
+    std::atomic_ref<uint32_t>(*mpCqHead).store(head + 1, std::memory_order_release);
+    return true;
+#else
+    return false;
+#endif // UPDATE_IO_URING
+  }
+
+protected:
+#if UPDATE_IO_URING
+  struct io_uring_sqe* getSqe(){
+    uint32_t tail = *mpSqTail;
+    if( tail - std::atomic_ref<uint32_t>(*mpSqHead).load(std::memory_order_acquire) >= mParams.sq_entries ) return nullptr;
+    struct io_uring_sqe* pSqe = &mpSqes[tail & mSqMask];
+    std::memset(pSqe, 0, sizeof(*pSqe));
+    return pSqe;
+  }
+
+  void commitSqe(){
+    uint32_t tail = *mpSqTail;
+    mpSqArray[tail & mSqMask] = tail & mSqMask;
+    std::atomic_ref<uint32_t>(*mpSqTail).store(tail + 1, std::memory_order_release);
+    mPendingCount++;
+  }
+#endif // UPDATE_IO_URING
+};
+
+
+class ConcreteUpdateHalBlockDeviceImpl;
+
+// the progress is the durable one reported by the concrete HAL instead of the accepted size by write()
+class UpdateDurableSessionImpl : public UpdateSessionImpl
+{
+public:
+  using UpdateSessionImpl::UpdateSessionImpl;
+
+protected:
+  virtual uint64_t getProgressedSize();
+};
+
+
+// --- reference HAL of the block device such as /dev/mmcblk0p5 per id. The regular file works as well.
+//     The chunks are copied to the aligned pooled buffers and written by io_uring with O_DIRECT. queueDepth buffers are in flight
+//     then write() returns without waiting the device. The progress is the size made durable by the fdatasync every syncInterval.
+//     The synchronous pwrite() is used if io_uring isn't available. Each id is written by one writer at once.
+//     Switching the active slot is platform specific then activateForNext() is no-op.
+class ConcreteUpdateHalBlockDeviceImpl : public IConcreteUpdateHal, public std::enable_shared_from_this<ConcreteUpdateHalBlockDeviceImpl>
+{
+public:
+  static constexpr size_t DIRECT_IO_ALIGNMENT = 4096;
+
+protected:
+  static constexpr uint64_t SYNC_TAG = 1ULL << 63;    // user data of the sync. The rest is the durable offset
+  static constexpr uint64_t PARTIAL_TAG = 1ULL << 62; // user data of the partial buffer written by sync(). It isn't released.
+
+  struct Slot
+  {
+    std::string path;
+    int fd = -1;
+    bool isRegularFile = false;
+    bool isDirectIo = false;
+    UpdateIoUring ring;
+    bool isFixedBuffers = false;
+    uint8_t* pBuffers = nullptr;
+    std::vector<uint32_t> freeBuffers;
+    int currentBuffer = -1;
+    size_t currentSize = 0;      // the filled size of the current buffer
+    uint64_t currentOffset = 0;  // the device offset of the current buffer
+    uint64_t writtenSize = 0;
+    uint64_t syncedOffset = 0;   // the offset of the last requested sync
+    uint32_t inFlightCount = 0;
+    std::atomic<uint64_t> durableSize = 0;
+    int error = 0;
+  };
+
+  const uint64_t mImageSize;
+  const uint32_t mQueueDepth;
+  const size_t mBufferSize;
+  const uint64_t mSyncInterval;
+  std::map<std::string, std::unique_ptr<Slot>> mSlots;
+
+  Slot& getSlot(const std::string& id){
+    auto it = mSlots.find(id);
+    if( it == mSlots.end() ){
+      throwBadId(id);
+    }
+    return *it->second;
+  }
+
+  uint8_t* getBuffer(Slot& slot, uint32_t index){
+    return slot.pBuffers + index * mBufferSize;
+  }
+
+  void throwIfError(const std::string& id, Slot& slot){
+    if( slot.error ){
+      throw IllegalStateException( std::string("The id ") + id + " failed to write : " + std::strerror(slot.error) );
+    }
+  }
+
+  void onCompletion(Slot& slot, const UpdateIoUring::Completion& completion){
+    slot.inFlightCount--;
+    if( completion.result < 0 ){
+      slot.error = -completion.result;
+    } else if( completion.userData & SYNC_TAG ){
+      slot.durableSize.store( std::min<uint64_t>(mImageSize, completion.userData & ~SYNC_TAG), std::memory_order_release );
+    } else if( !(completion.userData & PARTIAL_TAG) ){
+      slot.freeBuffers.push_back( (uint32_t)completion.userData );
+    }
+  }
+
+  // submit the prepared requests and reap the completions. waitCount > 0 blocks until the completion.
+  void reap(Slot& slot, uint32_t waitCount){
+    if( !slot.ring.submit(waitCount) ){
+      slot.error = errno ? errno : EIO;
+      return;
+    }
+    UpdateIoUring::Completion completion;
+    while( slot.ring.popCompletion(completion) ){
+      onCompletion(slot, completion);
+    }
+  }
+
+  void waitAll(Slot& slot){
+    while( slot.inFlightCount && !slot.error ){
+      reap(slot, 1);
+    }
+  }
+
+  uint32_t acquireBuffer(Slot& slot){
+    while( slot.freeBuffers.empty() && !slot.error ){
+      reap(slot, 1);
+    }
+    if( slot.freeBuffers.empty() ) return 0; // error
+    uint32_t index = slot.freeBuffers.back();
+    slot.freeBuffers.pop_back();
+    return index;
+  }
+
+  void submitWrite(Slot& slot, uint32_t bufferIndex, size_t size, uint64_t offset, uint64_t userData){
+    const uint8_t* pBuffer = getBuffer(slot, bufferIndex);
+    if( slot.ring.isAvailable() ){
+      while( !slot.ring.prepareWrite(slot.fd, pBuffer, size, offset, userData, slot.isFixedBuffers ? (int)bufferIndex : -1) && !slot.error ){
+        reap(slot, 1);
+      }
+      slot.inFlightCount++;
+    } else {
+      ssize_t writtenSize = ::pwrite(slot.fd, pBuffer, size, offset);
+      slot.inFlightCount++;
+      onCompletion(slot, UpdateIoUring::Completion{ userData, writtenSize == (ssize_t)size ? (int32_t)writtenSize : -(errno ? errno : EIO) });
+    }
+  }
+
+  // the durable size is the offset when the previous writes are completed and synced
+  void submitSync(Slot& slot, uint64_t offset){
+    slot.syncedOffset = offset;
+    if( slot.ring.isAvailable() ){
+      while( !slot.ring.prepareSync(slot.fd, SYNC_TAG | offset) && !slot.error ){
+        reap(slot, 1);
+      }
+      slot.inFlightCount++;
+    } else {
+      slot.inFlightCount++;
+      onCompletion(slot, UpdateIoUring::Completion{ SYNC_TAG | offset, ::fdatasync(slot.fd) == 0 ? 0 : -errno });
+    }
+  }
+
+  // O_DIRECT requires the aligned size. The padding is truncated for the regular file.
+  static size_t getAlignedSize(size_t size){
+    return ( size + DIRECT_IO_ALIGNMENT - 1 ) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+  }
+
+  void resetSlot(Slot& slot, uint64_t offset){
+    slot.freeBuffers.clear();
+    for(uint32_t i = 0; i < mQueueDepth; i++){
+      slot.freeBuffers.push_back(mQueueDepth - 1 - i);
+    }
+    slot.currentOffset = offset - offset % DIRECT_IO_ALIGNMENT;
+    slot.currentSize = offset % DIRECT_IO_ALIGNMENT;
+    slot.currentBuffer = -1;
+    slot.writtenSize = offset;
+    slot.syncedOffset = offset;
+    slot.durableSize = offset;
+    slot.inFlightCount = 0;
+    slot.error = 0;
+  }
+
+  void openSlot(const std::string& id, Slot& slot, bool isTruncated){
+    if( slot.fd >= 0 ){
+      waitAll(slot);
+      ::close(slot.fd);
+      slot.fd = -1;
+    }
+#ifdef O_DIRECT
+    slot.fd = ::open(slot.path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC | O_DIRECT, 0644);
+    slot.isDirectIo = ( slot.fd >= 0 );
+#endif // O_DIRECT
+    if( slot.fd < 0 ){
+      // such as tmpfs which doesn't support O_DIRECT
+      slot.fd = ::open(slot.path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    }
+    struct stat st;
+    if( slot.fd < 0 || ::fstat(slot.fd, &st) != 0 ){
+      throw IllegalStateException( std::string("The id ") + id + " failed to open " + slot.path + " : " + std::strerror(errno) );
+    }
+    slot.isRegularFile = S_ISREG(st.st_mode);
+    if( slot.isRegularFile ){
+      // the sparse file of the image size. The extending writes serialize on the inode.
+      if( ( isTruncated && ::ftruncate(slot.fd, 0) != 0 ) || ::ftruncate(slot.fd, mImageSize) != 0 ){
+        throw IllegalStateException( std::string("The id ") + id + " failed to truncate " + slot.path + " : " + std::strerror(errno) );
+      }
+    }
+
+    if( !slot.pBuffers ){
+      slot.pBuffers = static_cast<uint8_t*>( std::aligned_alloc(DIRECT_IO_ALIGNMENT, mBufferSize * mQueueDepth) );
+      if( !slot.pBuffers ){
+        throw IllegalStateException("Can't allocate the I/O buffers");
+      }
+      if( slot.ring.open(mQueueDepth + 1) ){ // + the sync
+        std::vector<struct iovec> buffers;
+        for(uint32_t i = 0; i < mQueueDepth; i++){
+          buffers.push_back( iovec{ getBuffer(slot, i), mBufferSize } );
+        }
+        slot.isFixedBuffers = slot.ring.registerBuffers(buffers);
+      }
+    }
+    resetSlot(slot, 0);
+  }
+
+  // write the rest and make all of them durable
+  void flush(Slot& slot){
+    if( slot.currentBuffer >= 0 && slot.currentSize ){
+      uint8_t* pBuffer = getBuffer(slot, slot.currentBuffer);
+      size_t alignedSize = getAlignedSize(slot.currentSize);
+      std::memset(pBuffer + slot.currentSize, 0, alignedSize - slot.currentSize);
+      submitWrite(slot, slot.currentBuffer, alignedSize, slot.currentOffset, slot.currentBuffer);
+      slot.currentBuffer = -1;
+    }
+    submitSync(slot, slot.writtenSize);
+    waitAll(slot);
+    if( slot.isRegularFile && !slot.error && ::ftruncate(slot.fd, slot.writtenSize) != 0 ){
+      slot.error = errno;
+    }
+  }
+
+public:
+  // devicePaths : the next slot's block device (or the file) of each id. The buffers are rounded up to the alignment.
+  ConcreteUpdateHalBlockDeviceImpl(std::map<std::string, std::string> devicePaths, uint64_t imageSize, uint32_t queueDepth = 8, size_t bufferSize = 1024*1024, uint64_t syncInterval = 16*1024*1024)
+    : mImageSize(imageSize), mQueueDepth(std::max<uint32_t>(1, queueDepth)), mBufferSize(getAlignedSize(std::max<size_t>(1, bufferSize))), mSyncInterval(syncInterval)
+  {
+    for(auto& [id, path] : devicePaths){
+      mSlots[id] = std::make_unique<Slot>();
+      mSlots[id]->path = path;
+    }
+  }
+
+  virtual ~ConcreteUpdateHalBlockDeviceImpl(){
+    for(auto& [id, pSlot] : mSlots){
+      if( pSlot->fd >= 0 ){
+        waitAll(*pSlot);
+        ::close(pSlot->fd);
+      }
+      pSlot->ring.close();
+      std::free(pSlot->pBuffers);
+    }
+  }
+
+  // false if the file system doesn't support O_DIRECT
+  bool isDirectIo(std::string id){
+    return getSlot(id).isDirectIo;
+  }
+
+  // false if it's written by the synchronous pwrite()
+  bool isIoUring(std::string id){
+    return getSlot(id).ring.isAvailable();
+  }
+
+  virtual std::vector<std::string> getSupportedIds(){
+    std::vector<std::string> ids;
+    for(auto& [id, pSlot] : mSlots){
+      ids.push_back(id);
+    }
+    return ids;
+  }
+
+  virtual std::map<std::string, std::string> getMetaDataById(std::string id){
+    getSlot(id);
+    return std::map<std::string, std::string>({});
+  }
+
+  virtual void validate(std::string id, COMPLETION_CALLBACK completion){
+    Slot& slot = getSlot(id);
+    waitAll(slot);
+    completion(id, !slot.error && slot.durableSize.load() == mImageSize);
+  }
+
+  virtual void activateForNext(std::string id, COMPLETION_CALLBACK completion){
+    getSlot(id);
+    completion(id, true);
+  }
+
+  virtual void restartAndWaitToBoot(std::string id, COMPLETION_CALLBACK completion){
+    getSlot(id);
+    completion(id, true);
+  }
+
+  using IConcreteUpdateHal::write;
+  virtual bool write(std::string id, std::span<const uint8_t> chunk){
+    Slot& slot = getSlot(id);
+    if( slot.fd < 0 ) return false;
+    throwIfError(id, slot);
+    while( !chunk.empty() ){
+      if( slot.currentBuffer < 0 ){
+        slot.currentBuffer = acquireBuffer(slot);
+        throwIfError(id, slot);
+      }
+      size_t size = std::min(mBufferSize - slot.currentSize, chunk.size());
+      std::memcpy(getBuffer(slot, slot.currentBuffer) + slot.currentSize, chunk.data(), size);
+      slot.currentSize += size;
+      slot.writtenSize += size;
+      chunk = chunk.subspan(size);
+      if( slot.currentSize == mBufferSize ){
+        submitWrite(slot, slot.currentBuffer, mBufferSize, slot.currentOffset, slot.currentBuffer);
+        slot.currentOffset += mBufferSize;
+        slot.currentBuffer = -1;
+        slot.currentSize = 0;
+        if( slot.currentOffset - slot.syncedOffset >= mSyncInterval ){
+          submitSync(slot, slot.currentOffset);
+        }
+      }
+    }
+    if( slot.writtenSize >= mImageSize ){
+      flush(slot);
+    } else if( slot.ring.isAvailable() ){
+      reap(slot, 0); // submit without waiting
+    }
+    throwIfError(id, slot);
+    return true;
+  }
+
+  virtual float getProgressPercent(std::string id){
+    return mImageSize ? std::min(100.0f, (float)getDurableSize(id)/(float)mImageSize*100.0f) : 100.0f;
+  }
+
+  // the size made durable by the fdatasync
+  uint64_t getDurableSize(std::string id){
+    return getSlot(id).durableSize.load(std::memory_order_acquire);
+  }
+
+  virtual bool cancel(std::string id){
+    Slot& slot = getSlot(id);
+    waitAll(slot);
+    resetSlot(slot, 0);
+    return true;
+  }
+
+  // the partial buffer is written as well. It's written again when it's filled.
+  virtual bool sync(std::string id){
+    Slot& slot = getSlot(id);
+    if( slot.fd < 0 ) return false;
+    if( slot.currentBuffer >= 0 && slot.currentSize ){
+      uint8_t* pBuffer = getBuffer(slot, slot.currentBuffer);
+      size_t alignedSize = getAlignedSize(slot.currentSize);
+      std::memset(pBuffer + slot.currentSize, 0, alignedSize - slot.currentSize);
+      submitWrite(slot, slot.currentBuffer, alignedSize, slot.currentOffset, PARTIAL_TAG | slot.currentBuffer);
+    }
+    submitSync(slot, slot.writtenSize);
+    waitAll(slot);
+    return !slot.error;
+  }
+
+  // continue from the offset. The head of the partial block is read back into the current buffer.
+  virtual bool resumeWrite(std::string id, uint64_t offset){
+    Slot& slot = getSlot(id);
+    if( slot.fd < 0 || offset > mImageSize ) return false;
+    waitAll(slot);
+    resetSlot(slot, offset);
+    if( slot.currentSize ){
+      slot.currentBuffer = acquireBuffer(slot);
+      if( ::pread(slot.fd, getBuffer(slot, slot.currentBuffer), DIRECT_IO_ALIGNMENT, slot.currentOffset) < (ssize_t)slot.currentSize ){
+        return false;
+      }
+    }
+    return true;
+  }
+
+  virtual std::shared_ptr<IUpdateSession> startUpdateSession(std::string id, IUpdateCore::COMPLETION_CALLBACK completion = nullptr, IUpdateSession::UpdateType type = IUpdateSession::UpdateType::FULL){
+    openSlot(id, getSlot(id), true);
+    return std::make_shared<UpdateDurableSessionImpl>( id, mImageSize, completion, shared_from_this(), type );
+  }
+
+  virtual std::shared_ptr<IUpdateSession> resumeUpdateSession(std::string id, IUpdateCore::COMPLETION_CALLBACK completion = nullptr){
+    openSlot(id, getSlot(id), false);
+    return std::make_shared<UpdateDurableSessionImpl>( id, mImageSize, completion, shared_from_this(), IUpdateSession::UpdateType::FULL );
+  }
+};
+
+inline uint64_t UpdateDurableSessionImpl::getProgressedSize(){
+  return mConcreteHal ? static_cast<ConcreteUpdateHalBlockDeviceImpl*>(mConcreteHal.get())->getDurableSize(mId) : UpdateSessionImpl::getProgressedSize();
+}
+
+#endif // __UPDATE_BLOCK_DEVICE_HAL_HPP__
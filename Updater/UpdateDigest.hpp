@@ -0,0 +1,288 @@
+/*
+  Copyright (C) 2025 hidenorly
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef __UPDATE_DIGEST_HPP__
+#define __UPDATE_DIGEST_HPP__
+
+#include <string>
+#include <span>
+#include <array>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define UPDATE_DIGEST_SHA_NI 1
+#else
+#define UPDATE_DIGEST_SHA_NI 0
+#endif
+
+
+// --- incremental digest of the written image
+class IUpdateDigest
+{
+public:
+  virtual ~IUpdateDigest(){}
+
+  virtual void reset() = 0;
+  virtual void update(std::span<const uint8_t> data) = 0;
+  // the digest of the data so far as lower case hex. update() can continue after this.
+  virtual std::string getHexDigest() = 0;
+  virtual size_t getDigestSize() = 0;
+
+  // the intermediate state to continue the digest after restarting. Empty if it's not supported.
+  virtual std::vector<uint8_t> saveState(){
+    return std::vector<uint8_t>();
+  }
+  virtual bool restoreState(std::span<const uint8_t> state){
+    return false;
+  }
+};
+
+
+// --- SHA-256 (FIPS 180-4). SHA-NI is used if the CPU supports it.
+class Sha256Digest : public IUpdateDigest
+{
+public:
+  static constexpr size_t DIGEST_SIZE = 32;
+  static constexpr size_t BLOCK_SIZE = 64;
+
+protected:
+  static constexpr uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+  };
+
+  std::array<uint32_t, 8> mState;
+  uint8_t mBuffer[BLOCK_SIZE];
+  size_t mBufferedSize;
+  uint64_t mTotalSize;
+  bool mIsAccelerated;
+
+  static uint32_t rotr(uint32_t x, int n){
+    return (x >> n) | (x << (32 - n));
+  }
+
+  static void processBlocksPortable(uint32_t* state, const uint8_t* data, size_t blockCount){
+    for(size_t n = 0; n < blockCount; n++, data += BLOCK_SIZE){
+      uint32_t w[64];
+      for(int i = 0; i < 16; i++){
+        w[i] = ((uint32_t)data[i*4] << 24) | ((uint32_t)data[i*4+1] << 16) | ((uint32_t)data[i*4+2] << 8) | (uint32_t)data[i*4+3];
+      }
+      for(int i = 16; i < 64; i++){
+        uint32_t s0 = rotr(w[i-15], 7) ^ rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+        uint32_t s1 = rotr(w[i-2], 17) ^ rotr(w[i-2], 19) ^ (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+      }
+      uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+      for(int i = 0; i < 64; i++){
+        uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+      }
+      state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+      state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+  }
+
+#if UPDATE_DIGEST_SHA_NI
+  // 4 rounds per iteration with the message schedule by sha256msg1/sha256msg2
+  __attribute__((target("sha,sse4.1,ssse3")))
+  static void processBlocksShaNi(uint32_t* state, const uint8_t* data, size_t blockCount){
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xB1); // CDAB
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1B); // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0); // CDGH
+
+    for(size_t n = 0; n < blockCount; n++, data += BLOCK_SIZE){
+      const __m128i abefSave = state0;
+      const __m128i cdghSave = state1;
+      __m128i msgs[4];
+      for(int i = 0; i < 4; i++){
+        msgs[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + i*16)), MASK);
+      }
+      for(int i = 0; i < 16; i++){
+        __m128i& current = msgs[i & 3];
+        __m128i msg = _mm_add_epi32(current, _mm_loadu_si128((const __m128i*)&K[i*4]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        if( i >= 3 && i <= 14 ){
+          __m128i& next = msgs[(i + 1) & 3];
+          next = _mm_add_epi32(next, _mm_alignr_epi8(current, msgs[(i + 3) & 3], 4));
+          next = _mm_sha256msg2_epu32(next, current);
+        }
+        msg = _mm_shuffle_epi32(msg, 0x0E);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+        if( i >= 1 && i <= 12 ){
+          __m128i& previous = msgs[(i + 3) & 3];
+          previous = _mm_sha256msg1_epu32(previous, current);
+        }
+      }
+      state0 = _mm_add_epi32(state0, abefSave);
+      state1 = _mm_add_epi32(state1, cdghSave);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B); // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1); // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0); // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8); // HGFE
+    _mm_storeu_si128((__m128i*)&state[0], state0);
+    _mm_storeu_si128((__m128i*)&state[4], state1);
+  }
+#endif // UPDATE_DIGEST_SHA_NI
+
+  void processBlocks(uint32_t* state, const uint8_t* data, size_t blockCount){
+#if UPDATE_DIGEST_SHA_NI
+    if( mIsAccelerated ){
+      processBlocksShaNi(state, data, blockCount);
+      return;
+    }
+#endif // UPDATE_DIGEST_SHA_NI
+    processBlocksPortable(state, data, blockCount);
+  }
+
+public:
+  static bool isAccelerationSupported(){
+#if UPDATE_DIGEST_SHA_NI
+    unsigned int eax, ebx, ecx, edx;
+    if( !__get_cpuid(1, &eax, &ebx, &ecx, &edx) ) return false;
+    const bool hasSse = ( ecx & bit_SSSE3 ) && ( ecx & bit_SSE4_1 );
+    if( !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) ) return false;
+    return hasSse && ( ebx & bit_SHA );
+#else
+    return false;
+#endif // UPDATE_DIGEST_SHA_NI
+  }
+
+  Sha256Digest(bool useAcceleration = true):mIsAccelerated(useAcceleration && isAccelerationSupported()){
+    reset();
+  }
+  virtual ~Sha256Digest(){}
+
+  bool isAccelerated(){
+    return mIsAccelerated;
+  }
+
+  virtual void reset(){
+    mState = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    mBufferedSize = 0;
+    mTotalSize = 0;
+  }
+
+  virtual void update(std::span<const uint8_t> data){
+    const uint8_t* pData = data.data();
+    size_t size = data.size();
+    mTotalSize += size;
+    if( mBufferedSize ){
+      size_t copySize = std::min(size, BLOCK_SIZE - mBufferedSize);
+      std::memcpy(mBuffer + mBufferedSize, pData, copySize);
+      mBufferedSize += copySize;
+      pData += copySize;
+      size -= copySize;
+      if( mBufferedSize < BLOCK_SIZE ) return;
+      processBlocks(mState.data(), mBuffer, 1);
+      mBufferedSize = 0;
+    }
+    // the full blocks are hashed in place without copying
+    processBlocks(mState.data(), pData, size / BLOCK_SIZE);
+    pData += size - size % BLOCK_SIZE;
+    mBufferedSize = size % BLOCK_SIZE;
+    std::memcpy(mBuffer, pData, mBufferedSize);
+  }
+
+  std::array<uint8_t, DIGEST_SIZE> getDigest(){
+    std::array<uint32_t, 8> state = mState;
+    uint8_t padding[BLOCK_SIZE * 2] = {0};
+    std::memcpy(padding, mBuffer, mBufferedSize);
+    padding[mBufferedSize] = 0x80;
+    const size_t paddedSize = ( mBufferedSize + 9 <= BLOCK_SIZE ) ? BLOCK_SIZE : BLOCK_SIZE * 2;
+    const uint64_t bitSize = mTotalSize * 8;
+    for(int i = 0; i < 8; i++){
+      padding[paddedSize - 1 - i] = (uint8_t)(bitSize >> (i * 8));
+    }
+    processBlocks(state.data(), padding, paddedSize / BLOCK_SIZE);
+
+    std::array<uint8_t, DIGEST_SIZE> result;
+    for(int i = 0; i < 8; i++){
+      result[i*4] = (uint8_t)(state[i] >> 24);
+      result[i*4+1] = (uint8_t)(state[i] >> 16);
+      result[i*4+2] = (uint8_t)(state[i] >> 8);
+      result[i*4+3] = (uint8_t)state[i];
+    }
+    return result;
+  }
+
+  virtual std::string getHexDigest(){
+    static const char* HEX = "0123456789abcdef";
+    std::string result;
+    for(auto& byte : getDigest()){
+      result += HEX[byte >> 4];
+      result += HEX[byte & 0x0f];
+    }
+    return result;
+  }
+
+  virtual size_t getDigestSize(){
+    return DIGEST_SIZE;
+  }
+
+  // state[8], total size and the buffered bytes. The integers are little endian.
+  virtual std::vector<uint8_t> saveState(){
+    std::vector<uint8_t> result;
+    auto put = [&](uint64_t value, int size){
+      for(int i = 0; i < size; i++){
+        result.push_back( (uint8_t)(value >> (i * 8)) );
+      }
+    };
+    for(auto& value : mState){
+      put(value, 4);
+    }
+    put(mTotalSize, 8);
+    result.insert(result.end(), mBuffer, mBuffer + mBufferedSize);
+    return result;
+  }
+
+  virtual bool restoreState(std::span<const uint8_t> state){
+    if( state.size() < 40 || state.size() - 40 >= BLOCK_SIZE ) return false;
+    auto get = [&](size_t pos, int size){
+      uint64_t value = 0;
+      for(int i = 0; i < size; i++){
+        value |= (uint64_t)state[pos + i] << (i * 8);
+      }
+      return value;
+    };
+    for(int i = 0; i < 8; i++){
+      mState[i] = (uint32_t)get(i * 4, 4);
+    }
+    mTotalSize = get(32, 8);
+    mBufferedSize = state.size() - 40;
+    if( mTotalSize % BLOCK_SIZE != mBufferedSize ) return false;
+    std::copy(state.begin() + 40, state.end(), mBuffer);
+    return true;
+  }
+};
+
+#endif // __UPDATE_DIGEST_HPP__
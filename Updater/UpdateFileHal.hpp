@@ -0,0 +1,253 @@
+/*
+  Copyright (C) 2025 hidenorly
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef __UPDATE_FILE_HAL_HPP__
+#define __UPDATE_FILE_HAL_HPP__
+
+#include "Updater.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+
+
+// --- fake flash : the A/B slots of each id are the sparse files <directory>/<id>.active and <directory>/<id>.next
+//     The chunks are pwrite()-n to the next slot. O_DIRECT bypasses the page cache if the file system supports it.
+//     The ids are fixed at the construction and each id is written by one writer at once.
+class ConcreteUpdateHalFileImpl : public IConcreteUpdateHal, public std::enable_shared_from_this<ConcreteUpdateHalFileImpl>
+{
+public:
+  enum class SyncPolicy
+  {
+    NONE,         // left to the page cache. sync() is no-op
+    EVERY_CHUNK,  // fdatasync() after each chunk
+    AT_END,       // fdatasync() after the last chunk and by sync()
+  };
+  static constexpr size_t DIRECT_IO_ALIGNMENT = 4096;
+
+protected:
+  struct Slot
+  {
+    int fd = -1;
+    int directFd = -1;
+    uint64_t writtenSize = 0;
+    uint8_t* pBounceBuffer = nullptr;
+    size_t bounceBufferSize = 0;
+  };
+
+  const std::string mDirectory;
+  const uint64_t mImageSize;
+  const SyncPolicy mSyncPolicy;
+  const bool mUseDirectIo;
+  std::map<std::string, Slot> mSlots;
+
+  std::string getPath(const std::string& id, bool isActive){
+    return mDirectory + "/" + id + ( isActive ? ".active" : ".next" );
+  }
+
+  Slot& getSlot(const std::string& id){
+    auto it = mSlots.find(id);
+    if( it == mSlots.end() ){
+      throwBadId(id);
+    }
+    return it->second;
+  }
+
+  static void throwIoError(const std::string& id, const char* operation){
+    throw IllegalStateException( std::string("The id ") + id + " failed to " + operation + " : " + std::strerror(errno) );
+  }
+
+  void closeSlot(Slot& slot){
+    if( slot.fd >= 0 ) ::close(slot.fd);
+    if( slot.directFd >= 0 ) ::close(slot.directFd);
+    slot.fd = slot.directFd = -1;
+  }
+
+  void openSlot(const std::string& id, Slot& slot, bool isTruncated){
+    closeSlot(slot);
+    std::string path = getPath(id, false);
+    slot.fd = ::open(path.c_str(), O_WRONLY | O_CREAT | ( isTruncated ? O_TRUNC : 0 ), 0644);
+    // the sparse file of the image size. The blocks are allocated by the writes.
+    if( slot.fd < 0 || ::ftruncate(slot.fd, mImageSize) != 0 ){
+      throwIoError(id, "open the next slot");
+    }
+#ifdef O_DIRECT
+    if( mUseDirectIo ){
+      // -1 if the file system doesn't support O_DIRECT such as tmpfs. Then it's written through the page cache.
+      slot.directFd = ::open(path.c_str(), O_WRONLY | O_DIRECT);
+    }
+#endif // O_DIRECT
+  }
+
+  static bool pwriteFully(int fd, const uint8_t* pData, size_t size, uint64_t offset){
+    while( size ){
+      ssize_t writtenSize = ::pwrite(fd, pData, size, offset);
+      if( writtenSize < 0 && errno == EINTR ) continue;
+      if( writtenSize <= 0 ) return false;
+      pData += writtenSize;
+      size -= writtenSize;
+      offset += writtenSize;
+    }
+    return true;
+  }
+
+  // the aligned part is written by O_DIRECT and the unaligned tail is written through the page cache
+  void writeSlot(const std::string& id, Slot& slot, std::span<const uint8_t> chunk){
+    size_t directSize = 0;
+    if( slot.directFd >= 0 && slot.writtenSize % DIRECT_IO_ALIGNMENT == 0 ){
+      directSize = chunk.size() - chunk.size() % DIRECT_IO_ALIGNMENT;
+    }
+    if( directSize ){
+      const uint8_t* pData = chunk.data();
+      if( reinterpret_cast<uintptr_t>(pData) % DIRECT_IO_ALIGNMENT ){
+        if( slot.bounceBufferSize < directSize ){
+          std::free(slot.pBounceBuffer);
+          slot.pBounceBuffer = static_cast<uint8_t*>( std::aligned_alloc(DIRECT_IO_ALIGNMENT, directSize) );
+          slot.bounceBufferSize = slot.pBounceBuffer ? directSize : 0;
+          if( !slot.pBounceBuffer ){
+            throw IllegalStateException("Can't allocate the O_DIRECT buffer");
+          }
+        }
+        std::memcpy(slot.pBounceBuffer, pData, directSize);
+        pData = slot.pBounceBuffer;
+      }
+      if( !pwriteFully(slot.directFd, pData, directSize, slot.writtenSize) ){
+        throwIoError(id, "write");
+      }
+    }
+    if( directSize < chunk.size() && !pwriteFully(slot.fd, chunk.data() + directSize, chunk.size() - directSize, slot.writtenSize + directSize) ){
+      throwIoError(id, "write");
+    }
+    slot.writtenSize += chunk.size();
+
+    if( mSyncPolicy == SyncPolicy::EVERY_CHUNK || ( mSyncPolicy == SyncPolicy::AT_END && slot.writtenSize >= mImageSize ) ){
+      if( ::fdatasync(slot.fd) != 0 ){
+        throwIoError(id, "sync");
+      }
+    }
+  }
+
+public:
+  ConcreteUpdateHalFileImpl(std::string directory, std::vector<std::string> ids, uint64_t imageSize, SyncPolicy syncPolicy = SyncPolicy::AT_END, bool useDirectIo = false):mDirectory(directory), mImageSize(imageSize), mSyncPolicy(syncPolicy), mUseDirectIo(useDirectIo){
+    for(auto& id : ids){
+      mSlots[id] = Slot();
+    }
+  }
+
+  virtual ~ConcreteUpdateHalFileImpl(){
+    for(auto& [id, slot] : mSlots){
+      closeSlot(slot);
+      std::free(slot.pBounceBuffer);
+    }
+  }
+
+  // remove the slot files such as after the benchmark
+  void removeSlotFiles(){
+    for(auto& [id, slot] : mSlots){
+      closeSlot(slot);
+      ::unlink( getPath(id, false).c_str() );
+      ::unlink( getPath(id, true).c_str() );
+    }
+  }
+
+  // false if O_DIRECT isn't requested or isn't supported by the file system
+  bool isDirectIo(std::string id){
+    return getSlot(id).directFd >= 0;
+  }
+
+  virtual std::vector<std::string> getSupportedIds(){
+    std::vector<std::string> ids;
+    for(auto& [id, slot] : mSlots){
+      ids.push_back(id);
+    }
+    return ids;
+  }
+
+  virtual std::map<std::string, std::string> getMetaDataById(std::string id){
+    getSlot(id);
+    return std::map<std::string, std::string>({});
+  }
+
+  virtual void validate(std::string id, COMPLETION_CALLBACK completion){
+    completion(id, getSlot(id).writtenSize == mImageSize);
+  }
+
+  virtual void activateForNext(std::string id, COMPLETION_CALLBACK completion){
+    Slot& slot = getSlot(id);
+    closeSlot(slot);
+    completion(id, ::rename( getPath(id, false).c_str(), getPath(id, true).c_str() ) == 0);
+  }
+
+  virtual void restartAndWaitToBoot(std::string id, COMPLETION_CALLBACK completion){
+    getSlot(id);
+    completion(id, true);
+  }
+
+  using IConcreteUpdateHal::write;
+  virtual bool write(std::string id, std::span<const uint8_t> chunk){
+    Slot& slot = getSlot(id);
+    if( slot.fd < 0 ) return false;
+    writeSlot(id, slot, chunk);
+    return true;
+  }
+
+  virtual float getProgressPercent(std::string id){
+    return mImageSize ? std::min(100.0f, (float)getSlot(id).writtenSize/(float)mImageSize*100.0f) : 100.0f;
+  }
+
+  virtual bool cancel(std::string id){
+    getSlot(id).writtenSize = 0;
+    return true;
+  }
+
+  virtual size_t readActive(std::string id, uint64_t offset, std::span<uint8_t> buffer){
+    getSlot(id);
+    int fd = ::open(getPath(id, true).c_str(), O_RDONLY);
+    if( fd < 0 ) return 0;
+    ssize_t readSize = ::pread(fd, buffer.data(), buffer.size(), offset);
+    ::close(fd);
+    return readSize > 0 ? readSize : 0;
+  }
+
+  virtual bool sync(std::string id){
+    Slot& slot = getSlot(id);
+    return mSyncPolicy == SyncPolicy::NONE || slot.fd < 0 || ::fdatasync(slot.fd) == 0;
+  }
+
+  virtual bool resumeWrite(std::string id, uint64_t offset){
+    Slot& slot = getSlot(id);
+    if( slot.fd < 0 || offset > mImageSize ) return false;
+    slot.writtenSize = offset;
+    return true;
+  }
+
+  virtual std::shared_ptr<IUpdateSession> startUpdateSession(std::string id, IUpdateCore::COMPLETION_CALLBACK completion = nullptr, IUpdateSession::UpdateType type = IUpdateSession::UpdateType::FULL){
+    Slot& slot = getSlot(id);
+    openSlot(id, slot, true);
+    slot.writtenSize = 0;
+    return std::make_shared<UpdateSessionImpl>( id, mImageSize, completion, shared_from_this(), type );
+  }
+
+  // the next slot file is kept then the written chunks survive the interruption
+  virtual std::shared_ptr<IUpdateSession> resumeUpdateSession(std::string id, IUpdateCore::COMPLETION_CALLBACK completion = nullptr){
+    Slot& slot = getSlot(id);
+    openSlot(id, slot, false);
+    slot.writtenSize = 0;
+    return std::make_shared<UpdateSessionImpl>( id, mImageSize, completion, shared_from_this(), IUpdateSession::UpdateType::FULL );
+  }
+};
+
+#endif // __UPDATE_FILE_HAL_HPP__
@@ -25,6 +25,8 @@
 #include <string_view>
 #include <source_location>
 #include <sstream>
+#include <random>
+#include <future>
 #include <cxxabi.h>
 
 #define USE_PLUGIN 1 // 1:Using Plug-in / 0:Using local mock impl.
@@ -133,7 +135,8 @@ public:
     return (type == IUpdateSession::UpdateType::FULL);
   }
 
-  virtual bool write(std::string id, std::vector<uint8_t> chunk){
+  using IConcreteUpdateHal::write;
+  virtual bool write(std::string id, std::span<const uint8_t> chunk){
     bool result = false;
     if( mSessions.contains(id) && mSessions[id] ){
       result = mSessions[id]->write(chunk);
@@ -202,10 +205,7 @@ public:
     mockImpls.push_back( std::make_shared<ConcreteUpdateHalMockImpl2>() );
 
     for( auto& impl : mockImpls ){
-      auto ids = impl->getSupportedIds();
-      for( auto& id : ids ){
-        mConcreteHals[id] = impl;
-      }
+      registerConcreteHal(impl);
     }
   }
 
@@ -215,6 +215,171 @@ public:
 #endif // USE_PLUGIN
 
 
+// --- in-memory A/B slots of the single subsystem. This supports DELTA by reading the active slot.
+class ConcreteUpdateHalMemoryImpl : public IConcreteUpdateHal, public std::enable_shared_from_this<ConcreteUpdateHalMemoryImpl>
+{
+protected:
+  const std::string mId;
+  std::vector<uint8_t> mActiveImage;
+  std::vector<uint8_t> mNextImage;
+  const size_t mImageSize;
+  const std::string mHash;
+
+public:
+  ConcreteUpdateHalMemoryImpl(std::string id, std::vector<uint8_t> activeImage, size_t nextImageSize, std::string hash = ""):mId(id), mActiveImage(std::move(activeImage)), mImageSize(nextImageSize), mHash(hash){
+  }
+  virtual ~ConcreteUpdateHalMemoryImpl() = default;
+
+  virtual std::vector<std::string> getSupportedIds(){
+    return std::vector<std::string>({ mId });
+  }
+
+  virtual std::map<std::string, std::string> getMetaDataById(std::string id){
+    if( id != mId ) throwBadId(id);
+    std::map<std::string, std::string> result;
+    if( !mHash.empty() ){
+      result[META_HASH] = mHash;
+    }
+    return result;
+  }
+
+  virtual void validate(std::string id, COMPLETION_CALLBACK completion){
+    if( id != mId ) throwBadId(id);
+    completion(id, mNextImage.size() == mImageSize);
+  }
+
+  virtual void activateForNext(std::string id, COMPLETION_CALLBACK completion){
+    if( id != mId ) throwBadId(id);
+    mActiveImage.swap(mNextImage);
+    completion(id, true);
+  }
+
+  virtual void restartAndWaitToBoot(std::string id, COMPLETION_CALLBACK completion){
+    if( id != mId ) throwBadId(id);
+    completion(id, true);
+  }
+
+  using IConcreteUpdateHal::write;
+  virtual bool write(std::string id, std::span<const uint8_t> chunk){
+    if( id != mId ) return false;
+    mNextImage.insert(mNextImage.end(), chunk.begin(), chunk.end());
+    return true;
+  }
+
+  virtual float getProgressPercent(std::string id){
+    return mImageSize ? std::min(100.0f, (float)mNextImage.size()/(float)mImageSize*100.0f) : 100.0f;
+  }
+
+  virtual bool cancel(std::string id){
+    mNextImage.clear();
+    return true;
+  }
+
+  virtual size_t readActive(std::string id, uint64_t offset, std::span<uint8_t> buffer){
+    if( id != mId || offset >= mActiveImage.size() ) return 0;
+    size_t size = std::min<uint64_t>(buffer.size(), mActiveImage.size() - offset);
+    std::copy(mActiveImage.begin() + offset, mActiveImage.begin() + offset + size, buffer.begin());
+    return size;
+  }
+
+  virtual std::shared_ptr<IUpdateSession> startUpdateSession(std::string id, IUpdateCore::COMPLETION_CALLBACK completion = nullptr, IUpdateSession::UpdateType type = IUpdateSession::UpdateType::FULL){
+    if( id != mId ) throwBadId(id);
+    mNextImage.clear();
+    mNextImage.reserve(mImageSize);
+    return std::make_shared<UpdateSessionImpl>( id, mImageSize, completion, shared_from_this(), type );
+  }
+
+  // the next image survives the interruption such as the flash
+  virtual std::shared_ptr<IUpdateSession> resumeUpdateSession(std::string id, IUpdateCore::COMPLETION_CALLBACK completion = nullptr){
+    if( id != mId ) throwBadId(id);
+    return std::make_shared<UpdateSessionImpl>( id, mImageSize, completion, shared_from_this(), IUpdateSession::UpdateType::FULL );
+  }
+
+  virtual bool resumeWrite(std::string id, uint64_t offset){
+    if( id != mId || offset > mNextImage.size() ) return false;
+    mNextImage.resize(offset);
+    return true;
+  }
+
+  const std::vector<uint8_t>& getNextImage(){
+    return mNextImage;
+  }
+};
+
+
+// the in-memory HAL whose storage fails after failAt bytes
+class ConcreteUpdateHalFailingImpl : public ConcreteUpdateHalMemoryImpl
+{
+protected:
+  const size_t mFailAt;
+
+public:
+  ConcreteUpdateHalFailingImpl(std::string id, size_t nextImageSize, size_t failAt):ConcreteUpdateHalMemoryImpl(id, std::vector<uint8_t>(), nextImageSize), mFailAt(failAt){
+  }
+  virtual ~ConcreteUpdateHalFailingImpl() = default;
+
+  using ConcreteUpdateHalMemoryImpl::write;
+  virtual bool write(std::string id, std::span<const uint8_t> chunk){
+    if( mNextImage.size() + chunk.size() > mFailAt ) return false;
+    return ConcreteUpdateHalMemoryImpl::write(id, chunk);
+  }
+};
+
+
+// DELTA against FULL on the synthetic image whose 5% of the blocks are modified
+void benchmark_delta(size_t imageSize = 32*1024*1024, uint32_t blockSize = 4096)
+{
+  std::mt19937 random(1234);
+  std::vector<uint8_t> source(imageSize);
+  for(auto& data : source){
+    data = (uint8_t)random();
+  }
+  std::vector<uint8_t> target = source;
+  const size_t blockCount = imageSize / blockSize;
+  for(size_t i = 0; i < blockCount / 20; i++){
+    size_t offset = (random() % blockCount) * blockSize;
+    switch( i % 3 ){
+      case 0: // a few bytes are changed
+        for(int j = 0; j < 16; j++){
+          target[offset + random() % blockSize] ^= 0xff;
+        }
+        break;
+      case 1: // the new block
+        for(size_t j = 0; j < blockSize; j++){
+          target[offset + j] = (uint8_t)random();
+        }
+        break;
+      case 2: // the moved block
+        std::copy_n(source.begin() + (random() % blockCount) * blockSize, blockSize, target.begin() + offset);
+        break;
+    }
+  }
+
+  auto startTime = std::chrono::steady_clock::now();
+  UpdateDeltaGenerator::Stat stat;
+  std::vector<uint8_t> patch = UpdateDeltaGenerator::generate(source, target, blockSize, &stat);
+  auto endTime = std::chrono::steady_clock::now();
+  std::cout << "delta generated[mSec] : " << std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count() << " copy=" << stat.copyBlocks << " patch=" << stat.patchBlocks << " data=" << stat.dataBlocks << std::endl;
+
+  for(auto type : {IUpdateSession::UpdateType::FULL, IUpdateSession::UpdateType::DELTA}){
+    const std::vector<uint8_t>& image = (type == IUpdateSession::UpdateType::FULL) ? target : patch;
+    auto pHal = std::make_shared<ConcreteUpdateHalMemoryImpl>("system", source, target.size());
+    auto session = pHal->startUpdateSession("system", nullptr, type);
+    size_t pos = 0;
+    UpdateWritePipeline pipeline(1024*1024, 4);
+    startTime = std::chrono::steady_clock::now();
+    size_t transferredSize = pipeline.run(session, [&](std::span<uint8_t> buffer){
+      size_t size = std::min(buffer.size(), image.size() - pos);
+      std::copy(image.begin() + pos, image.begin() + pos + size, buffer.begin());
+      pos += size;
+      return size;
+    });
+    endTime = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(endTime - startTime).count();
+    std::cout << ((type == IUpdateSession::UpdateType::FULL) ? "FULL" : "DELTA") << " transferred[bytes] : " << transferredSize << " elapsed[mSec] : " << (int)(elapsed * 1000) << " elapsed at 100Mbps[mSec] : " << (int)((elapsed + transferredSize * 8 / 100e6) * 1000) << " matched : " << (pHal->getNextImage() == target) << std::endl;
+  }
+}
+
 
 std::shared_ptr<IUpdateInstallHal> UpdateInstallHalFactory::getInstance()
 {
@@ -231,6 +396,36 @@ std::shared_ptr<IUpdateInstallHal> UpdateInstallHalFactory::getInstance()
 std::shared_ptr<IUpdateInstallHal> UpdateInstallHalFactory::mInstance;
 
 
+// the dispatch of the progress polling by the id string against the interned handle
+void benchmark_dispatch(std::shared_ptr<UpdateInstallHalImpl> pHal, int subsystemCount = 64, int pollCount = 200000)
+{
+  std::vector<std::string> ids;
+  for(int i = 0; i < subsystemCount; i++){
+    ids.push_back( std::string("benchmark_partition_") + std::to_string(i) );
+    pHal->registerConcreteHal( std::make_shared<ConcreteUpdateHalMemoryImpl>(ids.back(), std::vector<uint8_t>(), 1) );
+  }
+  std::vector<SubsystemHandle> handles;
+  for(auto& id : ids){
+    handles.push_back( pHal->resolve(id) );
+  }
+
+  float sum = 0.0f;
+  auto startTime = std::chrono::steady_clock::now();
+  for(int i = 0; i < pollCount; i++){
+    sum += pHal->getProgressPercent( ids[i % subsystemCount] );
+  }
+  auto stringTime = std::chrono::steady_clock::now();
+  for(int i = 0; i < pollCount; i++){
+    sum += pHal->getProgressPercent( handles[i % subsystemCount] );
+  }
+  auto handleTime = std::chrono::steady_clock::now();
+
+  std::cout << "dispatch by id[nSec/call] : " << std::chrono::duration_cast<std::chrono::nanoseconds>(stringTime - startTime).count() / pollCount;
+  std::cout << " by handle[nSec/call] : " << std::chrono::duration_cast<std::chrono::nanoseconds>(handleTime - stringTime).count() / pollCount;
+  std::cout << " subsystems=" << subsystemCount << " (" << sum << ")" << std::endl;
+}
+
+
 int main(int argc, char** argv) {
   std::shared_ptr<IUpdateInstallHal> hal = UpdateInstallHalFactory::getInstance();
 
@@ -302,5 +497,282 @@ int main(int argc, char** argv) {
     ex.dump();
   }
 
+  // pipelined write : the image is read by 64KB chunks with 4 buffers
+  if( !id_for_test.empty() ){
+    auto session = hal->startUpdateSession(id_for_test, [&](std::string id, bool isSuccessfullyDone){
+      std::cout << "PipelinedWriteCompletion::id=" << id << " : " << (isSuccessfullyDone ? "Completed" : "Not Completed") << std::endl;
+    });
+    size_t remaining = MockConstants::DUMMY_SIZE;
+    uint8_t checksum = 0;
+    UpdateWritePipeline pipeline(64*1024, 4);
+    size_t writtenSize = pipeline.run(session, [&](std::span<uint8_t> buffer){
+      size_t size = std::min(buffer.size(), remaining);
+      std::fill(buffer.begin(), buffer.begin() + size, (uint8_t)(remaining >> 16));
+      remaining -= size;
+      return size;
+    }, [&](std::span<const uint8_t> chunk){
+      for(auto& data : chunk){
+        checksum += data;
+      }
+    });
+    std::cout << "id=" << id_for_test << " pipelined written=" << writtenSize << " progress=" << std::to_string(session->getProgressPercent()) << " peak memory=" << pipeline.getPeakMemorySize() << " checksum=" << (int)checksum << std::endl;
+  }
+
+  // orchestrated update : the targets on the different concrete HALs are written in parallel
+  auto pHalImpl = std::dynamic_pointer_cast<UpdateInstallHalImpl>(hal);
+  if( pHalImpl ){
+    UpdateOrchestrator orchestrator(pHalImpl, 4, 1, 64*1024, 4);
+    std::mutex outputMutex;
+    orchestrator.setStageCallback([&](std::string id, UpdateOrchestrator::Stage stage, bool isSuccessfullyDone){
+      std::lock_guard<std::mutex> lock(outputMutex);
+      std::cout << "Orchestrator::id=" << id << " " << UpdateOrchestrator::getStageName(stage) << " : " << (isSuccessfullyDone ? "Completed" : "Not Completed") << std::endl;
+    });
+    for(auto id : {"system", "vendor", "mcu_1", "adc_system", "adc_vendor"}){
+      if( !pHalImpl->resolve(id).isValid() ) continue; // depends on the loaded plug-ins
+      auto remaining = std::make_shared<size_t>(MockConstants::DUMMY_SIZE);
+      orchestrator.addTarget(id, [remaining](std::span<uint8_t> buffer){
+        size_t size = std::min(buffer.size(), *remaining);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1)); // as the network
+        *remaining -= size;
+        return size;
+      }, std::string(id) == "mcu_1");
+    }
+    // activate mcu_1 only after system validates
+    if( pHalImpl->resolve("mcu_1").isValid() && pHalImpl->resolve("system").isValid() ){
+      orchestrator.addDependency("mcu_1", UpdateOrchestrator::Stage::ACTIVATE, "system", UpdateOrchestrator::Stage::VALIDATE);
+    }
+    auto startTime = std::chrono::steady_clock::now();
+    auto results = orchestrator.run();
+    auto endTime = std::chrono::steady_clock::now();
+    for(auto& [id, isSuccessfullyDone] : results){
+      std::cout << "id=" << id << " orchestrated update : " << (isSuccessfullyDone ? "Completed" : "Not Completed") << std::endl;
+    }
+    std::cout << "orchestrated update elapsed[mSec] : " << std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count() << std::endl;
+  }
+
+  // streamed digest verification : the image is verified while writing
+  {
+    std::vector<uint8_t> image(MockConstants::DUMMY_SIZE);
+    for(size_t i=0; i<image.size(); i++){
+      image[i] = (uint8_t)(i * 31);
+    }
+    Sha256Digest digest;
+    digest.update(image);
+    for(auto expectedDigest : {digest.getHexDigest(), std::string(Sha256Digest::DIGEST_SIZE * 2, '0')}){
+      auto session = std::make_shared<UpdateSessionImpl>("system", MockConstants::DUMMY_SIZE, [&](std::string id, bool isSuccessfullyDone){
+        std::cout << "StreamedDigestCompletion::id=" << id << " : " << (isSuccessfullyDone ? "Completed" : "Not Completed") << std::endl;
+      });
+      session->setExpectedDigest(expectedDigest);
+      size_t pos = 0;
+      UpdateWritePipeline pipeline(64*1024, 4);
+      pipeline.run(session, [&](std::span<uint8_t> buffer){
+        size_t size = std::min(buffer.size(), image.size() - pos);
+        std::copy(image.begin() + pos, image.begin() + pos + size, buffer.begin());
+        pos += size;
+        return size;
+      });
+      std::cout << "digest verified=" << session->isDigestVerified() << " matched=" << session->isDigestMatched() << std::endl;
+    }
+  }
+
+  // resumable update : the power is lost at ~80% and the session resumes from the last checkpoint
+  if( pHalImpl ){
+    const size_t imageSize = 32*1024*1024;
+    std::vector<uint8_t> image(imageSize);
+    for(size_t i=0; i<image.size(); i++){
+      image[i] = (uint8_t)(i * 7 + (i >> 12));
+    }
+    Sha256Digest digest;
+    digest.update(image);
+    auto pMemoryHal = std::make_shared<ConcreteUpdateHalMemoryImpl>("resumable", std::vector<uint8_t>(), imageSize, digest.getHexDigest());
+    pHalImpl->registerConcreteHal(pMemoryHal);
+    pHalImpl->setJournalDirectory(".", 8*1024*1024);
+    auto completion = [&](std::string id, bool isSuccessfullyDone){
+      std::cout << "ResumableCompletion::id=" << id << " : " << (isSuccessfullyDone ? "Completed" : "Not Completed") << std::endl;
+    };
+    auto writeFrom = [&](std::shared_ptr<IUpdateSession> session, size_t pos, size_t end){
+      UpdateWritePipeline pipeline(1024*1024, 4);
+      return pipeline.run(session, [&](std::span<uint8_t> buffer){
+        size_t size = std::min(buffer.size(), end - pos);
+        std::copy(image.begin() + pos, image.begin() + pos + size, buffer.begin());
+        pos += size;
+        return size;
+      });
+    };
+    try{
+      auto session = hal->startUpdateSession("resumable", completion);
+      size_t writtenSize = writeFrom(session, 0, imageSize * 8 / 10);
+      session.reset(); // power loss
+      std::cout << "interrupted at=" << writtenSize << " next image=" << pMemoryHal->getNextImage().size() << std::endl;
+
+      auto startTime = std::chrono::steady_clock::now();
+      session = pHalImpl->resumeUpdateSession("resumable", completion);
+      size_t offset = session->getWrittenSize();
+      size_t rewrittenSize = writeFrom(session, offset, imageSize);
+      auto endTime = std::chrono::steady_clock::now();
+      std::cout << "resumed from=" << offset << " rewritten=" << rewrittenSize << " (" << rewrittenSize * 100 / imageSize << "% of image) elapsed[mSec] : " << std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count() << std::endl;
+      std::cout << "next image matched=" << (pMemoryHal->getNextImage() == image) << std::endl;
+      pHalImpl->validate("resumable", completion);
+    } catch (BaseException& ex){
+      ex.dump();
+    }
+    pHalImpl->setJournalDirectory("");
+  }
+
+  // completion executor : the completions run on the executor's thread and the HAL operations return the future
+  if( pHalImpl ){
+    const size_t imageSize = 4*1024*1024;
+    pHalImpl->registerConcreteHal( std::make_shared<ConcreteUpdateHalMemoryImpl>("async_system", std::vector<uint8_t>(), imageSize) );
+    pHalImpl->setCompletionExecutor( std::make_shared<UpdateThreadPool>(1) );
+    const std::thread::id writerThreadId = std::this_thread::get_id();
+    std::promise<bool> writePromise;
+    auto session = pHalImpl->startUpdateSession("async_system", [&](std::string id, bool isSuccessfullyDone){
+      std::cout << "AsyncWriteCompletion::id=" << id << " : " << (isSuccessfullyDone ? "Completed" : "Not Completed") << " on writer thread=" << (std::this_thread::get_id() == writerThreadId) << std::endl;
+      writePromise.set_value(isSuccessfullyDone);
+    });
+    std::vector<uint8_t> chunk(imageSize/4);
+    while( session->write(chunk) );
+    try{
+      bool result = writePromise.get_future().get()
+        && pHalImpl->validateAsync("async_system").get()
+        && pHalImpl->activateForNextAsync("async_system").get()
+        && pHalImpl->restartAndWaitToBootAsync("async_system").get();
+      std::cout << "async_system update : " << (result ? "Completed" : "Not Completed") << std::endl;
+      pHalImpl->validateAsync("unknown_system").get();
+    } catch (BaseException& ex){
+      ex.dump();
+    }
+    pHalImpl->setCompletionExecutor(nullptr);
+  }
+
+  // lazy HAL : the HAL is instantiated when the subsystem is touched at the first time
+  if( pHalImpl ){
+    pHalImpl->registerConcreteHal({"lazy_system", "lazy_vendor"}, [](){
+      std::cout << "lazy HAL is instantiated" << std::endl;
+      return std::make_shared<ConcreteUpdateHalMemoryImpl>("lazy_system", std::vector<uint8_t>(), 1);
+    });
+    SubsystemHandle handle = pHalImpl->resolve("lazy_system");
+    std::cout << "lazy_system resolved=" << handle.isValid() << std::endl;
+    for(int i = 0; i < 2; i++){
+      float progress = pHalImpl->getProgressPercent(handle);
+      std::cout << "lazy_system progress=" << progress << std::endl;
+    }
+  }
+
+  // progress : the writers push the throttled progress and the UI thread polls the aggregated progress with ETA
+  if( pHalImpl ){
+    const size_t chunkSize = 256*1024;
+    std::map<std::string, size_t> imageSizes = { {"progress_a", 16*1024*1024}, {"progress_b", 8*1024*1024} };
+    std::vector<std::shared_ptr<UpdateSessionImpl>> sessions;
+    std::vector<std::thread> writers;
+    for(auto& [id, imageSize] : imageSizes){
+      pHalImpl->registerConcreteHal( std::make_shared<ConcreteUpdateHalMemoryImpl>(id, std::vector<uint8_t>(), imageSize) );
+      auto session = std::dynamic_pointer_cast<UpdateSessionImpl>( pHalImpl->startUpdateSession(id, nullptr) );
+      if( !session ) continue;
+      sessions.push_back(session);
+      if( id == "progress_a" ){
+        session->subscribeProgress([](std::string id, const UpdateProgress& progress){
+          std::cout << "ProgressSubscriber::id=" << id << " " << progress.writtenSize << "/" << progress.totalSize << " (" << (int)progress.percent << "%)" << (progress.isCompleted ? " completed" : "") << std::endl;
+        }, 4*1024*1024, std::chrono::milliseconds(1000));
+      }
+      writers.push_back( std::thread([session, chunkSize](){
+        std::vector<uint8_t> chunk(chunkSize);
+        while( session->write(chunk) ){
+          std::this_thread::sleep_for(std::chrono::milliseconds(2)); // the download
+        }
+      }) );
+    }
+    UpdateProgress progress;
+    do{
+      std::this_thread::sleep_for(std::chrono::milliseconds(40));
+      progress = pHalImpl->getAggregateProgress();
+      std::cout << "aggregate progress=" << (int)progress.percent << "% throughput[MB/s]=" << (int)(progress.throughput / 1048576.0) << " ETA[mSec]=" << (int)(progress.remainingTime * 1000.0) << std::endl;
+    } while( !progress.isCompleted );
+    for(auto& writer : writers){
+      writer.join();
+    }
+
+    // the image over 4GB without the HAL
+    UpdateSessionImpl largeSession("large", 5ULL*1024*1024*1024, nullptr);
+    std::vector<uint8_t> chunk(64*1024*1024);
+    while( largeSession.write(chunk) );
+    std::cout << "large session written=" << largeSession.getWrittenSize() << " progress=" << largeSession.getProgressPercent() << std::endl;
+  }
+
+  // HAL write failure : the session is completed with false and the rest isn't written
+  {
+    auto pFailingHal = std::make_shared<ConcreteUpdateHalFailingImpl>("failing", 1024*1024, 512*1024);
+    auto session = std::dynamic_pointer_cast<UpdateSessionImpl>( pFailingHal->startUpdateSession("failing", [](std::string id, bool isSuccessfullyDone){
+      std::cout << "WriteFailureCompletion::id=" << id << " : " << (isSuccessfullyDone ? "Completed" : "Not Completed") << std::endl;
+    }) );
+    std::vector<uint8_t> chunk(128*1024);
+    int writeCount = 1;
+    while( session->write(chunk) ){
+      writeCount++;
+    }
+    std::cout << "write failed=" << session->isWriteFailed() << " writes=" << writeCount << " HAL written=" << pFailingHal->getNextImage().size() << std::endl;
+
+    // the orchestrator's WRITE stage fails and the rest of the stages don't run
+    if( pHalImpl ){
+      pHalImpl->registerConcreteHal( std::make_shared<ConcreteUpdateHalFailingImpl>("orchestrated_failing", 1024*1024, 512*1024) );
+      UpdateOrchestrator orchestrator(pHalImpl, 2, 1, 64*1024, 4);
+      orchestrator.setStageCallback([](std::string id, UpdateOrchestrator::Stage stage, bool isSuccessfullyDone){
+        std::cout << "Orchestrator::id=" << id << " " << UpdateOrchestrator::getStageName(stage) << " : " << (isSuccessfullyDone ? "Completed" : "Not Completed") << std::endl;
+      });
+      orchestrator.addTarget("orchestrated_failing", [](std::span<uint8_t> buffer){
+        std::fill(buffer.begin(), buffer.end(), 0);
+        return buffer.size();
+      });
+      for(auto& [id, isSuccessfullyDone] : orchestrator.run()){
+        std::cout << "id=" << id << " orchestrated update : " << (isSuccessfullyDone ? "Completed" : "Not Completed") << std::endl;
+      }
+    }
+  }
+
+  // write after the completion : it's rejected before reaching the HAL
+  {
+    auto pMemoryHal = std::make_shared<ConcreteUpdateHalMemoryImpl>("completed", std::vector<uint8_t>(), 8*1024);
+    auto session = pMemoryHal->startUpdateSession("completed", [](std::string id, bool isSuccessfullyDone){});
+    session->write(std::vector<uint8_t>(8*1024));
+    try{
+      session->write(std::vector<uint8_t>(4*1024));
+    } catch (BaseException& ex){
+      ex.dump();
+    }
+    std::cout << "HAL written after the rejected write=" << pMemoryHal->getNextImage().size() << " (expected " << 8*1024 << ")" << std::endl;
+  }
+
+  // forged delta : the block size over the limit is rejected before the block buffer is allocated
+  try{
+    std::vector<uint8_t> image(64*1024, 0x5a);
+    std::vector<uint8_t> delta = UpdateDeltaGenerator::generate(image, image);
+    std::fill(delta.begin() + 8, delta.begin() + 12, 0xff); // blockSize
+    UpdateDeltaApplier applier([&](uint64_t offset, std::span<uint8_t> buffer){ return (size_t)0; }, [&](std::span<const uint8_t> data){});
+    applier.write(delta);
+  } catch (BaseException& ex){
+    ex.dump();
+  }
+
+  // benchmark : subsystem dispatch
+  if( pHalImpl ){
+    benchmark_dispatch(pHalImpl);
+  }
+
+  // benchmark : DELTA update
+  benchmark_delta();
+
+  // benchmark : SHA-256 throughput
+  {
+    std::vector<uint8_t> image(64*1024*1024, 0x5a);
+    for(bool useAcceleration : {false, true}){
+      Sha256Digest digest(useAcceleration);
+      auto startTime = std::chrono::steady_clock::now();
+      digest.update(image);
+      std::string result = digest.getHexDigest();
+      auto endTime = std::chrono::steady_clock::now();
+      std::cout << "SHA-256 " << (digest.isAccelerated() ? "accelerated" : "portable") << " [MB/s] : " << (int)(image.size() / 1048576.0 / std::chrono::duration<double>(endTime - startTime).count()) << " " << result << std::endl;
+    }
+  }
+
   return 0;
 }
\ No newline at end of file
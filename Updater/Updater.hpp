@@ -16,6 +16,9 @@
 
 // clang++ -std=c++20 Updater.cxx 
 
+#ifndef __UPDATER_HPP__
+#define __UPDATER_HPP__
+
 #include <iostream>
 #include <vector>
 #include <unordered_map>
@@ -27,7 +30,20 @@
 #include <string_view>
 #include <source_location>
 #include <sstream>
+#include <span>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <atomic>
+#include <future>
+#include <chrono>
+#include <cctype>
+#include <fcntl.h>
+#include <unistd.h>
 #include <cxxabi.h>
+#include "UpdateDigest.hpp"
 
 // --- exception definitions ---
 enum class ExceptionSeverity {
@@ -154,8 +170,14 @@ public:
   };
 
 public:
-  virtual bool write(std::vector<uint8_t> chunk) = 0;
+  // the chunk is referred only during this call. Then the caller can reuse the buffer.
+  virtual bool write(std::span<const uint8_t> chunk) = 0;
+  bool write(const std::vector<uint8_t>& chunk){
+    return write(std::span<const uint8_t>(chunk));
+  }
   virtual float getProgressPercent() = 0;
+  // the bytes written by write(). The resumed session starts from the last checkpoint.
+  virtual uint64_t getWrittenSize() = 0;
 
   // cancel might be failed if B-side isn't supported
   virtual bool cancel() = 0;
@@ -167,6 +189,12 @@ class IUpdateStartSession
 public:
   // create session to write the new firmware image
   virtual std::shared_ptr<IUpdateSession> startUpdateSession(std::string id, IUpdateCore::COMPLETION_CALLBACK completion, IUpdateSession::UpdateType type = IUpdateSession::UpdateType::FULL) = 0;
+
+  // resume the interrupted session from the last durable checkpoint.
+  // Continue writing the image from getWrittenSize() of the returned session.
+  virtual std::shared_ptr<IUpdateSession> resumeUpdateSession(std::string id, IUpdateCore::COMPLETION_CALLBACK completion){
+    throw IllegalInvocationException("resumeUpdateSession isn't supported");
+  }
 };
 
 
@@ -183,215 +211,2046 @@ public:
     return true;
   }
 
-  virtual bool write(std::string id, std::vector<uint8_t> chunk) = 0;
+  virtual bool write(std::string id, std::span<const uint8_t> chunk) = 0;
+  bool write(std::string id, const std::vector<uint8_t>& chunk){
+    return write(id, std::span<const uint8_t>(chunk));
+  }
   virtual float getProgressPercent(std::string id) = 0;
 
   // cancel might be failed if B-side isn't supported
   virtual bool cancel(std::string id) = 0;
+
+  // read the active (running) image as the source of the DELTA update. Returns the read size.
+  virtual size_t readActive(std::string id, uint64_t offset, std::span<uint8_t> buffer){
+    return 0;
+  }
+
+  // make the written chunks durable. Called before recording the checkpoint.
+  virtual bool sync(std::string id){
+    return true;
+  }
+
+  // discard the written data after the offset and continue writing from there. false if the HAL can't resume.
+  virtual bool resumeWrite(std::string id, uint64_t offset){
+    return false;
+  }
 };
 
 
-// UpdateSession Impl
-class UpdateSessionImpl : public IUpdateSession
+class UpdateLittleEndian
 {
-protected:
-  const int mMaxSize;
-  int mWrittenSize;
-  const std::string mId;
-  const IUpdateCore::COMPLETION_CALLBACK mCompletion;
-  bool mIsCompleted;
-  std::shared_ptr<IConcreteUpdateHal> mConcreteHal;
-  UpdateType mType;
-
 public:
-  UpdateSessionImpl(
-    const std::string id, 
-    const int nSize, 
-    const IUpdateCore::COMPLETION_CALLBACK completion, 
-    std::shared_ptr<IConcreteUpdateHal> pConcreteHal = nullptr, 
-    IUpdateSession::UpdateType type = IUpdateSession::UpdateType::FULL )
-    : 
-    mId(id),
-    mMaxSize(nSize), 
-    mWrittenSize(0), 
-    mCompletion(completion), 
-    mIsCompleted(false), 
-    mConcreteHal(pConcreteHal),
-    mType(type)
-  {
+  static void putUint32(std::vector<uint8_t>& out, uint32_t value){
+    for(int i = 0; i < 4; i++){
+      out.push_back( (uint8_t)(value >> (i * 8)) );
+    }
   }
-  virtual ~UpdateSessionImpl(){};
 
-  virtual bool write(std::vector<uint8_t> chunk){
-    mWrittenSize += chunk.size();
-    bool result = mWrittenSize < mMaxSize;
-    if( !result && mCompletion ){
-      if( !mIsCompleted ){
-        mCompletion(mId, !result);
-        mIsCompleted = true;
-      } else {
-        throw IllegalInvocationException("Already done to update");
-      }
+  static void putUint64(std::vector<uint8_t>& out, uint64_t value){
+    for(int i = 0; i < 8; i++){
+      out.push_back( (uint8_t)(value >> (i * 8)) );
     }
-    return result;
   }
 
-  virtual float getProgressPercent(){
-    float progressPercent = (float)mWrittenSize/(float)mMaxSize*100.0f;
-    if( progressPercent> 100.0f ){
-      return 100.0f;
+  static uint32_t getUint32(const uint8_t* pData){
+    uint32_t result = 0;
+    for(int i = 0; i < 4; i++){
+      result |= (uint32_t)pData[i] << (i * 8);
     }
-    return progressPercent;
+    return result;
   }
 
-  virtual bool cancel(){
-    if( mIsCompleted ) return false;
-    mWrittenSize = 0;
-    return true;
+  static uint64_t getUint64(const uint8_t* pData){
+    uint64_t result = 0;
+    for(int i = 0; i < 8; i++){
+      result |= (uint64_t)pData[i] << (i * 8);
+    }
+    return result;
   }
 };
 
+// --- DELTA image : the target image is reconstructed from the active (source) image by the opcodes.
+//     header : magic, version, blockSize, targetSize
+//     COPY   : sourceOffset, length                        : copy from the source image
+//     DATA   : length, bytes                               : the literal bytes
+//     PATCH  : sourceOffset, length, runCount, runs        : copy from the source image and overwrite the runs (offset, length, bytes)
+//     END    :                                             : the target image has to be fully written
+//     The integers are little endian.
+class UpdateDeltaFormat : public UpdateLittleEndian
+{
+public:
+  static constexpr uint32_t MAGIC = 0x544c4455; // "UDLT"
+  static constexpr uint32_t VERSION = 1;
+  static constexpr size_t HEADER_SIZE = 20;
+  static constexpr size_t MAX_PATCH_LENGTH = 16*1024*1024;
+  static constexpr size_t MAX_BLOCK_SIZE = MAX_PATCH_LENGTH; // the applier buffers a block
+
+  enum Opcode : uint8_t {
+    OP_END = 0,
+    OP_COPY = 1,
+    OP_DATA = 2,
+    OP_PATCH = 3,
+  };
+};
 
-#if USE_PLUGIN
-// git clone https://github.com/hidenorly/plugin-manager.git
-#include "../plugin-manager/include/PlugInManager.hpp"
 
-class UpdaterPlugInBase : public IPlugIn, public IConcreteUpdateHal
+// --- DELTA generator : block level diff of the source and the target image
+class UpdateDeltaGenerator : public UpdateDeltaFormat
 {
 public:
-    UpdaterPlugInBase(){};
-    virtual ~UpdaterPlugInBase(){};
+  struct Stat
+  {
+    size_t copyBlocks;
+    size_t patchBlocks;
+    size_t dataBlocks;
+  };
 
-    /* @desc initialize at loading the  plug-in shared object such as .so */
-    virtual void onLoad(void){};
-    /* @desc uninitialize at unloading the  plug-in shared object such as .so */
-    virtual void onUnload(void){};
-    /* @desc report your  plug-in's unique id
-        @return unique plug-in id. may use uuid. */
-    virtual std::string getId(void){return "nothing";};
-    /* @desc report plugin type
-     @return plug-in type. */
-      virtual std::string getType(void){ return "UpdaterPlugInBase"; };
-    /* @desc this is expected to use by strategy
-        @return new YourConcreteClass()'s instanciated result */
-    virtual IPlugIn* newInstance(void) = 0;
-    virtual std::string toString(void){ return "NoPlugIn"; };
-    /* @desc capability report if this plug-in can support this device
-       @return true if current running device matches this plug-in */
-    virtual bool canHandle(void){ return true; };
-};
+protected:
+  static uint64_t hashBlock(std::span<const uint8_t> block){
+    uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a
+    for(auto& data : block){
+      hash = (hash ^ data) * 0x100000001b3ULL;
+    }
+    return hash;
+  }
 
-typedef TPlugInManager<UpdaterPlugInBase> UpdaterPlugInManager;
-#endif // USE_PLUGIN
+  static void putCopy(std::vector<uint8_t>& out, size_t& lastCopyPos, uint64_t sourceOffset, uint32_t length){
+    // extend the previous COPY if the source is contiguous
+    if( lastCopyPos != SIZE_MAX ){
+      uint64_t lastOffset = getUint64(&out[lastCopyPos + 1]);
+      uint32_t lastLength = getUint32(&out[lastCopyPos + 9]);
+      if( lastOffset + lastLength == sourceOffset && (uint64_t)lastLength + length <= UINT32_MAX ){
+        std::vector<uint8_t> field;
+        putUint32(field, lastLength + length);
+        std::copy(field.begin(), field.end(), out.begin() + lastCopyPos + 9);
+        return;
+      }
+    }
+    lastCopyPos = out.size();
+    out.push_back(OP_COPY);
+    putUint64(out, sourceOffset);
+    putUint32(out, length);
+  }
+
+  // the runs of the different bytes. The runs closer than the run header are merged.
+  static std::vector<std::pair<uint32_t, uint32_t>> getDiffRuns(std::span<const uint8_t> source, std::span<const uint8_t> target){
+    std::vector<std::pair<uint32_t, uint32_t>> runs;
+    for(uint32_t i = 0; i < target.size(); i++){
+      if( source[i] != target[i] ){
+        if( !runs.empty() && i - (runs.back().first + runs.back().second) < 8 ){
+          runs.back().second = i + 1 - runs.back().first;
+        } else {
+          runs.push_back( {i, 1} );
+        }
+      }
+    }
+    return runs;
+  }
 
+public:
+  static std::vector<uint8_t> generate(std::span<const uint8_t> source, std::span<const uint8_t> target, uint32_t blockSize = 4096, Stat* pStat = nullptr){
+    if( !blockSize || blockSize > MAX_BLOCK_SIZE ){
+      throw InvalidArgumentException("The delta block size is out of range");
+    }
+    std::vector<uint8_t> result;
+    putUint32(result, MAGIC);
+    putUint32(result, VERSION);
+    putUint32(result, blockSize);
+    putUint64(result, target.size());
+
+    // the source blocks by the hash to find the moved blocks
+    std::unordered_map<uint64_t, uint64_t> sourceBlocks;
+    for(uint64_t offset = 0; offset + blockSize <= source.size(); offset += blockSize){
+      sourceBlocks.try_emplace( hashBlock(source.subspan(offset, blockSize)), offset );
+    }
 
-// --- default impl. of IUpdateInstallHal ---
-//     Note that this delegates to instance of IConcreteUpdateHal
-class UpdateInstallHalImpl : public IUpdateInstallHal
+    Stat stat{0, 0, 0};
+    size_t lastCopyPos = SIZE_MAX;
+    size_t lastDataPos = SIZE_MAX;
+    for(uint64_t offset = 0; offset < target.size(); offset += blockSize){
+      auto block = target.subspan(offset, std::min<uint64_t>(blockSize, target.size() - offset));
+      // the same position
+      if( offset + block.size() <= source.size() && std::equal(block.begin(), block.end(), source.begin() + offset) ){
+        putCopy(result, lastCopyPos, offset, block.size());
+        lastDataPos = SIZE_MAX;
+        stat.copyBlocks++;
+        continue;
+      }
+      // the moved block
+      if( block.size() == blockSize ){
+        auto it = sourceBlocks.find( hashBlock(block) );
+        if( it != sourceBlocks.end() && std::equal(block.begin(), block.end(), source.begin() + it->second) ){
+          putCopy(result, lastCopyPos, it->second, block.size());
+          lastDataPos = SIZE_MAX;
+          stat.copyBlocks++;
+          continue;
+        }
+      }
+      // the partially modified block
+      if( offset + block.size() <= source.size() ){
+        auto runs = getDiffRuns(source.subspan(offset, block.size()), block);
+        size_t patchSize = 17;
+        for(auto& [runOffset, runLength] : runs){
+          patchSize += 8 + runLength;
+        }
+        if( patchSize < block.size() / 2 ){
+          result.push_back(OP_PATCH);
+          putUint64(result, offset);
+          putUint32(result, block.size());
+          putUint32(result, runs.size());
+          for(auto& [runOffset, runLength] : runs){
+            putUint32(result, runOffset);
+            putUint32(result, runLength);
+            result.insert(result.end(), block.begin() + runOffset, block.begin() + runOffset + runLength);
+          }
+          lastCopyPos = lastDataPos = SIZE_MAX;
+          stat.patchBlocks++;
+          continue;
+        }
+      }
+      // the new block. extend the previous DATA
+      if( lastDataPos != SIZE_MAX && (uint64_t)getUint32(&result[lastDataPos + 1]) + block.size() <= UINT32_MAX ){
+        std::vector<uint8_t> field;
+        putUint32(field, getUint32(&result[lastDataPos + 1]) + block.size());
+        std::copy(field.begin(), field.end(), result.begin() + lastDataPos + 1);
+      } else {
+        lastDataPos = result.size();
+        result.push_back(OP_DATA);
+        putUint32(result, block.size());
+      }
+      result.insert(result.end(), block.begin(), block.end());
+      lastCopyPos = SIZE_MAX;
+      stat.dataBlocks++;
+    }
+    result.push_back(OP_END);
+    if( pStat ){
+      *pStat = stat;
+    }
+    return result;
+  }
+};
+
+
+// --- DELTA applier : reconstruct the target image from the streamed patch chunks.
+//     The chunk can be split at any position. The literal bytes are passed to the writer without buffering.
+class UpdateDeltaApplier : public UpdateDeltaFormat
 {
+public:
+  // fill the buffer from the offset of the source image. Returns the read size.
+  typedef std::function<size_t(uint64_t offset, std::span<uint8_t> buffer)> SOURCE_READER;
+  // the reconstructed target image in order
+  typedef std::function<void(std::span<const uint8_t> data)> TARGET_WRITER;
+
 protected:
-    std::map<std::string, std::shared_ptr<IConcreteUpdateHal>> mConcreteHals;
-#if USE_PLUGIN
-    std::shared_ptr<UpdaterPlugInManager> mpManager;
-#endif // USE_PLUGIN
+  enum class State {
+    HEADER,
+    OPCODE,
+    OPERAND,
+    DATA,
+    RUN_HEADER,
+    RUN_DATA,
+    DONE,
+  };
 
-public:
-  UpdateInstallHalImpl(){
-#if USE_PLUGIN
-    UpdaterPlugInManager::setPlugInPath(".");
-    std::weak_ptr<UpdaterPlugInManager> pWeakManager = UpdaterPlugInManager::getManager();
-    mpManager = pWeakManager.lock();
-    if( mpManager ){
-      mpManager->initialize();
-
-      std::vector<std::string> plugInIds = mpManager->getPlugInIds();
-      for(auto& aPlugInId : plugInIds){
-        std::shared_ptr<UpdaterPlugInBase> thePlugIn = UpdaterPlugInManager::newInstanceById( aPlugInId );
-        if( thePlugIn && thePlugIn->canHandle() ){
-          std::vector<std::string> ids = thePlugIn->getSupportedIds();
-          for(auto& id : ids){
-            mConcreteHals[id] = thePlugIn;
+  SOURCE_READER mSourceReader;
+  TARGET_WRITER mTargetWriter;
+  State mState;
+  std::vector<uint8_t> mField;
+  size_t mFieldSize;
+  uint8_t mOpcode;
+  uint32_t mBlockSize;
+  uint64_t mTargetSize;
+  uint64_t mWrittenTargetSize;
+  uint64_t mRemaining;
+  uint32_t mRunCount;
+  uint32_t mRunOffset;
+  std::vector<uint8_t> mBlock;
+
+  void expect(State state, size_t fieldSize){
+    mState = state;
+    mField.clear();
+    mFieldSize = fieldSize;
+  }
+
+  void output(std::span<const uint8_t> data){
+    if( mWrittenTargetSize + data.size() > mTargetSize ){
+      throw InvalidArgumentException("The delta exceeds the target size");
+    }
+    mTargetWriter(data);
+    mWrittenTargetSize += data.size();
+  }
+
+  void readSource(uint64_t offset, std::span<uint8_t> buffer){
+    if( mSourceReader(offset, buffer) != buffer.size() ){
+      throw IllegalStateException("The source image is shorter than the delta");
+    }
+  }
+
+  void copySource(uint64_t offset, uint64_t length){
+    mBlock.resize(mBlockSize);
+    while( length ){
+      size_t size = std::min<uint64_t>(length, mBlockSize);
+      readSource(offset, std::span<uint8_t>(mBlock.data(), size));
+      output(std::span<const uint8_t>(mBlock.data(), size));
+      offset += size;
+      length -= size;
+    }
+  }
+
+  void onRunDone(){
+    if( --mRunCount ){
+      expect(State::RUN_HEADER, 8);
+    } else {
+      output(mBlock);
+      expect(State::OPCODE, 1);
+    }
+  }
+
+  void onField(){
+    const uint8_t* pField = mField.data();
+    switch( mState ){
+      case State::HEADER:
+        if( getUint32(pField) != MAGIC || getUint32(pField + 4) != VERSION || !getUint32(pField + 8) ){
+          throw InvalidArgumentException("The delta header is wrong");
+        }
+        mBlockSize = getUint32(pField + 8);
+        if( mBlockSize > MAX_BLOCK_SIZE ){
+          throw InvalidArgumentException("The delta block size is too large");
+        }
+        mTargetSize = getUint64(pField + 12);
+        expect(State::OPCODE, 1);
+        break;
+      case State::OPCODE:
+        mOpcode = pField[0];
+        switch( mOpcode ){
+          case OP_COPY: expect(State::OPERAND, 12); break;
+          case OP_DATA: expect(State::OPERAND, 4); break;
+          case OP_PATCH: expect(State::OPERAND, 16); break;
+          case OP_END:
+            if( mWrittenTargetSize != mTargetSize ){
+              throw InvalidArgumentException("The delta ends before the target size");
+            }
+            expect(State::DONE, 0);
+            break;
+          default:
+            throw InvalidArgumentException("The delta has the unknown opcode");
+        }
+        break;
+      case State::OPERAND:
+        if( mOpcode == OP_COPY ){
+          copySource(getUint64(pField), getUint32(pField + 8));
+          expect(State::OPCODE, 1);
+        } else if( mOpcode == OP_DATA ){
+          mRemaining = getUint32(pField);
+          expect(mRemaining ? State::DATA : State::OPCODE, mRemaining ? 0 : 1);
+        } else {
+          uint32_t length = getUint32(pField + 8);
+          if( length > MAX_PATCH_LENGTH ){
+            throw InvalidArgumentException("The delta patch is too large");
+          }
+          mBlock.resize(length);
+          readSource(getUint64(pField), mBlock);
+          mRunCount = getUint32(pField + 12);
+          if( mRunCount ){
+            expect(State::RUN_HEADER, 8);
+          } else {
+            output(mBlock);
+            expect(State::OPCODE, 1);
           }
         }
+        break;
+      case State::RUN_HEADER:
+        mRunOffset = getUint32(pField);
+        mRemaining = getUint32(pField + 4);
+        if( (uint64_t)mRunOffset + mRemaining > mBlock.size() ){
+          throw InvalidArgumentException("The delta patch run is out of the block");
+        }
+        if( mRemaining ){
+          expect(State::RUN_DATA, 0);
+        } else {
+          onRunDone();
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+public:
+  UpdateDeltaApplier(SOURCE_READER sourceReader, TARGET_WRITER targetWriter)
+    : mSourceReader(sourceReader), mTargetWriter(targetWriter), mOpcode(OP_END), mBlockSize(0), mTargetSize(0), mWrittenTargetSize(0), mRemaining(0), mRunCount(0), mRunOffset(0)
+  {
+    expect(State::HEADER, HEADER_SIZE);
+  }
+  virtual ~UpdateDeltaApplier(){}
+
+  void write(std::span<const uint8_t> chunk){
+    while( !chunk.empty() ){
+      size_t size = 0;
+      switch( mState ){
+        case State::DONE:
+          throw InvalidArgumentException("The delta has the data after the end");
+        case State::DATA:
+          size = std::min<uint64_t>(mRemaining, chunk.size());
+          output(chunk.first(size));
+          mRemaining -= size;
+          if( !mRemaining ){
+            expect(State::OPCODE, 1);
+          }
+          break;
+        case State::RUN_DATA:
+          size = std::min<uint64_t>(mRemaining, chunk.size());
+          std::copy(chunk.begin(), chunk.begin() + size, mBlock.begin() + mRunOffset);
+          mRunOffset += size;
+          mRemaining -= size;
+          if( !mRemaining ){
+            onRunDone();
+          }
+          break;
+        default:
+          size = std::min(mFieldSize - mField.size(), chunk.size());
+          mField.insert(mField.end(), chunk.begin(), chunk.begin() + size);
+          if( mField.size() == mFieldSize ){
+            onField();
+          }
+          break;
       }
+      chunk = chunk.subspan(size);
     }
-#endif // USE_PLUGIN
   }
-  virtual ~UpdateInstallHalImpl(){
-#if USE_PLUGIN
-    mpManager->terminate();
-#endif // USE_PLUGIN
+
+  // true when the END opcode is written
+  bool isCompleted(){
+    return mState == State::DONE;
   }
 
-  virtual std::vector<std::string> getSupportedIds(){
-    std::vector<std::string> ids;
-    for( auto& [id, hal] : mConcreteHals ){
-      ids.push_back(id);
+  uint64_t getTargetSize(){
+    return mTargetSize;
+  }
+
+  uint64_t getWrittenTargetSize(){
+    return mWrittenTargetSize;
+  }
+};
+
+
+// --- journal of the session's checkpoint. It's replaced atomically by rename() after fsync().
+//     The chunks are written sequentially then the written offset and the chunk count represent the written chunks.
+class UpdateSessionJournal : public UpdateLittleEndian
+{
+public:
+  static constexpr uint32_t MAGIC = 0x4c4e4a55; // "UJNL"
+  static constexpr uint32_t VERSION = 1;
+
+  struct Checkpoint
+  {
+    uint32_t type;
+    uint64_t maxSize;
+    uint64_t writtenSize;
+    uint64_t chunkCount;
+    std::string expectedDigest;
+    std::vector<uint8_t> digestState;
+  };
+
+protected:
+  const std::string mPath;
+
+  static uint64_t getChecksum(std::span<const uint8_t> data){
+    uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a
+    for(auto& byte : data){
+      hash = (hash ^ byte) * 0x100000001b3ULL;
     }
-    return ids;
+    return hash;
   }
 
-  virtual std::map<std::string, std::string> getMetaDataById(std::string id){
-    if( mConcreteHals.contains(id) && mConcreteHals[id] ){
-      return mConcreteHals[id]->getMetaDataById(id);
+  static bool writeFully(int fd, std::span<const uint8_t> data){
+    while( !data.empty() ){
+      ssize_t size = ::write(fd, data.data(), data.size());
+      if( size <= 0 ) return false;
+      data = data.subspan(size);
     }
-    return std::map<std::string, std::string>({});
+    return true;
   }
 
-  virtual std::shared_ptr<IUpdateSession> startUpdateSession(std::string id, IUpdateCore::COMPLETION_CALLBACK completion, IUpdateSession::UpdateType type = IUpdateSession::UpdateType::FULL){
-    std::shared_ptr<IUpdateSession> result;
-    if( mConcreteHals.contains(id) && mConcreteHals[id] ){
-      if( mConcreteHals[id]->canStartUpdateSession(id, type) ){
-        result = std::make_shared<UpdateSessionImpl>( id, 0, completion, mConcreteHals[id], type );
-      } else {
-        std::string msg = createMessageId(id);
-        msg += " on ";
-        msg += ( (type == IUpdateSession::UpdateType::FULL) ? "FULL" : "DELTA" );
-        throw IllegalStateException(msg);
+public:
+  UpdateSessionJournal(std::string path):mPath(path){}
+  virtual ~UpdateSessionJournal(){}
+
+  bool save(const Checkpoint& checkpoint){
+    std::vector<uint8_t> record;
+    putUint32(record, MAGIC);
+    putUint32(record, VERSION);
+    putUint32(record, checkpoint.type);
+    putUint64(record, checkpoint.maxSize);
+    putUint64(record, checkpoint.writtenSize);
+    putUint64(record, checkpoint.chunkCount);
+    putUint32(record, checkpoint.expectedDigest.size());
+    record.insert(record.end(), checkpoint.expectedDigest.begin(), checkpoint.expectedDigest.end());
+    putUint32(record, checkpoint.digestState.size());
+    record.insert(record.end(), checkpoint.digestState.begin(), checkpoint.digestState.end());
+    putUint64(record, getChecksum(record));
+
+    std::string tempPath = mPath + ".tmp";
+    int fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if( fd < 0 ) return false;
+    bool result = writeFully(fd, record) && ( ::fsync(fd) == 0 );
+    ::close(fd);
+    result = result && ( ::rename(tempPath.c_str(), mPath.c_str()) == 0 );
+    if( result ){
+      // the rename itself is durable by syncing the directory
+      std::string directory = mPath.substr(0, mPath.find_last_of('/') + 1);
+      int dirFd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY);
+      if( dirFd >= 0 ){
+        ::fsync(dirFd);
+        ::close(dirFd);
       }
-    } else {
-      throwBadId(id);
     }
     return result;
   }
 
-  virtual void validate(std::string id, IUpdateCore::COMPLETION_CALLBACK completion){
-    if( mConcreteHals.contains(id) && mConcreteHals[id] ){
-      mConcreteHals[id]->validate(id, completion);
-    } else {
-      completion(id, true);
-      throwBadId(id);
+  bool load(Checkpoint& checkpoint){
+    int fd = ::open(mPath.c_str(), O_RDONLY);
+    if( fd < 0 ) return false;
+    std::vector<uint8_t> record;
+    uint8_t buffer[4096];
+    ssize_t size;
+    while( (size = ::read(fd, buffer, sizeof(buffer))) > 0 && record.size() < 1024*1024 ){
+      record.insert(record.end(), buffer, buffer + size);
     }
+    ::close(fd);
+
+    size_t pos = 0;
+    auto has = [&](size_t size){ return pos + size <= record.size(); };
+    if( !has(40) || getUint32(&record[0]) != MAGIC || getUint32(&record[4]) != VERSION ) return false;
+    if( getUint64(&record[record.size() - 8]) != getChecksum(std::span<const uint8_t>(record.data(), record.size() - 8)) ) return false;
+    pos = 8;
+    checkpoint.type = getUint32(&record[pos]); pos += 4;
+    checkpoint.maxSize = getUint64(&record[pos]); pos += 8;
+    checkpoint.writtenSize = getUint64(&record[pos]); pos += 8;
+    checkpoint.chunkCount = getUint64(&record[pos]); pos += 8;
+    if( !has(4) ) return false;
+    size_t length = getUint32(&record[pos]); pos += 4;
+    if( !has(length + 4) ) return false;
+    checkpoint.expectedDigest.assign(record.begin() + pos, record.begin() + pos + length); pos += length;
+    length = getUint32(&record[pos]); pos += 4;
+    if( !has(length + 8) ) return false;
+    checkpoint.digestState.assign(record.begin() + pos, record.begin() + pos + length);
+    return true;
   }
 
-  virtual void activateForNext(std::string id, IUpdateCore::COMPLETION_CALLBACK completion){
-    if( mConcreteHals.contains(id) && mConcreteHals[id] ){
-      mConcreteHals[id]->activateForNext(id, completion);
-    } else {
-      completion(id, true);
-      throwBadId(id);
-    }
+  void remove(){
+    ::unlink(mPath.c_str());
   }
 
-  virtual void restartAndWaitToBoot(std::string id, IUpdateCore::COMPLETION_CALLBACK completion){
-    if( mConcreteHals.contains(id) && mConcreteHals[id] ){
-      mConcreteHals[id]->restartAndWaitToBoot(id, completion);
-    } else {
-      completion(id, true);
-      throwBadId(id);
-    }
+  std::string getPath(){
+    return mPath;
   }
 };
 
 
-class UpdateInstallHalFactory
+// --- executor of the completion callbacks. The callbacks are posted not to run on the caller's (e.g. writer's) thread.
+class IUpdateCompletionExecutor
+{
+public:
+  virtual ~IUpdateCompletionExecutor(){}
+  virtual void post(std::function<void(void)> task) = 0;
+};
+
+// run on the caller's thread as the synchronous callback
+class UpdateInlineExecutor : public IUpdateCompletionExecutor
+{
+public:
+  virtual void post(std::function<void(void)> task){
+    task();
+  }
+};
+
+
+// --- fixed size thread pool
+class UpdateThreadPool : public IUpdateCompletionExecutor
 {
 protected:
-  static std::shared_ptr<IUpdateInstallHal> mInstance;
+  std::vector<std::thread> mThreads;
+  std::deque<std::function<void(void)>> mTasks;
+  std::mutex mMutex;
+  std::condition_variable mCondition;
+  bool mIsTerminated;
 
 public:
-  static std::shared_ptr<IUpdateInstallHal> getInstance();
+  UpdateThreadPool(size_t threadCount = std::thread::hardware_concurrency()):mIsTerminated(false){
+    threadCount = std::max<size_t>(1, threadCount);
+    for(size_t i = 0; i < threadCount; i++){
+      mThreads.push_back( std::thread([this](){
+        while( true ){
+          std::function<void(void)> task;
+          {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCondition.wait(lock, [this](){ return mIsTerminated || !mTasks.empty(); });
+            if( mTasks.empty() ) break;
+            task = std::move(mTasks.front());
+            mTasks.pop_front();
+          }
+          task();
+        }
+      }) );
+    }
+  }
+
+  // the queued tasks are executed before terminating
+  virtual ~UpdateThreadPool(){
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mIsTerminated = true;
+    }
+    mCondition.notify_all();
+    for(auto& thread : mThreads){
+      thread.join();
+    }
+  }
+
+  virtual void post(std::function<void(void)> task){
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mTasks.push_back(std::move(task));
+    }
+    mCondition.notify_one();
+  }
+};
+
+
+// --- progress of the session. The sizes are of the target image (the reconstructed image on DELTA).
+struct UpdateProgress
+{
+  uint64_t writtenSize = 0;
+  uint64_t totalSize = 0;       // 0 if it's unknown yet such as before the DELTA header
+  float percent = 0.0f;
+  double throughput = 0.0;      // bytes/sec since the first write
+  double remainingTime = -1.0;  // sec. negative if it's unknown
+  bool isCompleted = false;
+
+  static UpdateProgress estimate(uint64_t writtenSize, uint64_t totalSize, double throughput, bool isCompleted){
+    UpdateProgress progress;
+    progress.writtenSize = writtenSize;
+    progress.totalSize = totalSize;
+    progress.percent = totalSize ? std::min(100.0f, (float)writtenSize/(float)totalSize*100.0f) : 0.0f;
+    progress.throughput = throughput;
+    progress.isCompleted = isCompleted;
+    if( isCompleted ){
+      progress.remainingTime = 0.0;
+    } else if( totalSize && throughput > 0.0 ){
+      progress.remainingTime = (double)( totalSize - std::min(writtenSize, totalSize) ) / throughput;
+    }
+    return progress;
+  }
 };
 
 
+// UpdateSession Impl
+class UpdateSessionImpl : public IUpdateSession
+{
+public:
+  typedef std::function<void(std::string id, const UpdateProgress& progress)> PROGRESS_CALLBACK;
+
+protected:
+  struct ProgressSubscription
+  {
+    int id;
+    PROGRESS_CALLBACK callback;
+    uint64_t sizeInterval;
+    std::chrono::steady_clock::duration timeInterval;
+    uint64_t notifiedSize;
+    std::chrono::steady_clock::time_point notifiedTime;
+  };
+
+  const uint64_t mMaxSize;
+  // the writer updates and the other threads such as UI read the progress
+  std::atomic<uint64_t> mWrittenSize;
+  std::atomic<uint64_t> mProgressSize;
+  std::atomic<uint64_t> mProgressTotalSize;
+  std::atomic<int64_t> mFirstWriteTime; // steady_clock. 0 before the first write
+  std::atomic<uint64_t> mFirstWriteSize;
+  const std::string mId;
+  const IUpdateCore::COMPLETION_CALLBACK mCompletion;
+  std::atomic<bool> mIsCompleted;
+  bool mIsWriteFailed;
+  std::shared_ptr<IConcreteUpdateHal> mConcreteHal;
+  UpdateType mType;
+  std::shared_ptr<IUpdateDigest> mDigest;
+  std::string mExpectedDigest;
+  bool mIsDigestVerified;
+  bool mIsDigestMatched;
+  std::shared_ptr<UpdateDeltaApplier> mDeltaApplier;
+  std::shared_ptr<UpdateSessionJournal> mJournal;
+  std::shared_ptr<IUpdateCompletionExecutor> mExecutor;
+  uint64_t mCheckpointInterval;
+  uint64_t mCheckpointedSize;
+  uint64_t mChunkCount;
+  std::vector<ProgressSubscription> mSubscriptions;
+  std::mutex mSubscriptionMutex;
+  std::atomic<bool> mHasSubscriptions;
+  int mNextSubscriptionId;
+
+  // the progressed size of the target image. It's the accepted size by write() then the durable session overrides it.
+  // Called by the writer.
+  virtual uint64_t getProgressedSize(){
+    return mDeltaApplier ? mDeltaApplier->getWrittenTargetSize() : mWrittenSize.load(std::memory_order_relaxed);
+  }
+
+  void updateProgress(){
+    mProgressTotalSize.store(mDeltaApplier ? mDeltaApplier->getTargetSize() : mMaxSize, std::memory_order_relaxed);
+    mProgressSize.store(getProgressedSize(), std::memory_order_release);
+  }
+
+  // push the progress to the subscribers whose interval is passed. The completion is always pushed.
+  void notifyProgress(bool isForced){
+    if( !mHasSubscriptions.load(std::memory_order_acquire) ) return;
+    std::vector<PROGRESS_CALLBACK> callbacks;
+    const UpdateProgress progress = getProgress();
+    const auto now = std::chrono::steady_clock::now();
+    {
+      std::lock_guard<std::mutex> lock(mSubscriptionMutex);
+      for(auto& subscription : mSubscriptions){
+        if( isForced || progress.writtenSize - std::min(progress.writtenSize, subscription.notifiedSize) >= subscription.sizeInterval || now - subscription.notifiedTime >= subscription.timeInterval ){
+          subscription.notifiedSize = progress.writtenSize;
+          subscription.notifiedTime = now;
+          callbacks.push_back(subscription.callback);
+        }
+      }
+    }
+    for(auto& callback : callbacks){
+      if( mExecutor ){
+        mExecutor->post([callback, id = mId, progress](){
+          callback(id, progress);
+        });
+      } else {
+        callback(mId, progress);
+      }
+    }
+  }
+
+  // the written chunks have to be durable on the HAL before the journal says so
+  void checkpoint(){
+    if( mConcreteHal && !mConcreteHal->sync(mId) ) return;
+    UpdateSessionJournal::Checkpoint checkpoint{ (uint32_t)mType, mMaxSize, mWrittenSize.load(), mChunkCount, mExpectedDigest, mDigest ? mDigest->saveState() : std::vector<uint8_t>() };
+    if( mJournal->save(checkpoint) ){
+      mCheckpointedSize = mWrittenSize;
+    }
+  }
+
+  // the chunks are the patch on DELTA. The source is the active image of the HAL.
+  void resetDeltaApplier(){
+    if( mType == IUpdateSession::UpdateType::DELTA && mConcreteHal ){
+      mDeltaApplier = std::make_shared<UpdateDeltaApplier>(
+        [this](uint64_t offset, std::span<uint8_t> buffer){
+          return mConcreteHal->readActive(mId, offset, buffer);
+        },
+        [this](std::span<const uint8_t> data){
+          writeTarget(data);
+        });
+    }
+  }
+
+  // the target image to the HAL : the chunk itself on FULL, the reconstructed image on DELTA.
+  // The session fails once the HAL fails to write then the rest isn't written.
+  void writeTarget(std::span<const uint8_t> data){
+    if( mIsWriteFailed ) return;
+    if( mConcreteHal && !mConcreteHal->write(mId, data) ){
+      mIsWriteFailed = true;
+      return;
+    }
+    if( mDigest && !mIsCompleted ){
+      mDigest->update(data);
+    }
+  }
+
+  // compare with the expected digest when the last chunk is written
+  bool verifyDigest(){
+    if( mDigest && !mExpectedDigest.empty() ){
+      std::string digest = mDigest->getHexDigest();
+      mIsDigestMatched = ( digest.size() == mExpectedDigest.size() ) && std::equal(digest.begin(), digest.end(), mExpectedDigest.begin(), [](char a, char b){
+        return std::tolower(a) == std::tolower(b);
+      });
+      mIsDigestVerified = true;
+      return mIsDigestMatched;
+    }
+    return true;
+  }
+
+public:
+  UpdateSessionImpl(
+    const std::string id, 
+    const uint64_t nSize, 
+    const IUpdateCore::COMPLETION_CALLBACK completion, 
+    std::shared_ptr<IConcreteUpdateHal> pConcreteHal = nullptr, 
+    IUpdateSession::UpdateType type = IUpdateSession::UpdateType::FULL )
+    : 
+    mId(id),
+    mMaxSize(nSize), 
+    mWrittenSize(0), 
+    mProgressSize(0),
+    mProgressTotalSize(nSize),
+    mFirstWriteTime(0),
+    mFirstWriteSize(0),
+    mCompletion(completion), 
+    mIsCompleted(false), 
+    mIsWriteFailed(false),
+    mConcreteHal(pConcreteHal),
+    mType(type),
+    mIsDigestVerified(false),
+    mIsDigestMatched(false),
+    mCheckpointInterval(0),
+    mCheckpointedSize(0),
+    mChunkCount(0),
+    mHasSubscriptions(false),
+    mNextSubscriptionId(0)
+  {
+    resetDeltaApplier();
+    updateProgress();
+  }
+  virtual ~UpdateSessionImpl(){};
+
+  // hash the chunks while writing and verify the image with expectedHexDigest such as META_HASH at the last chunk.
+  // The completion is called with false if it's mismatched. SHA-256 is used if pDigest isn't specified.
+  void setExpectedDigest(std::string expectedHexDigest, std::shared_ptr<IUpdateDigest> pDigest = nullptr){
+    mExpectedDigest = expectedHexDigest;
+    mDigest = pDigest ? pDigest : std::make_shared<Sha256Digest>();
+    mDigest->reset();
+  }
+
+  // true if the written image is already verified by the streamed digest. Then validate() doesn't need to read it again.
+  bool isDigestVerified(){
+    return mIsDigestVerified;
+  }
+
+  bool isDigestMatched(){
+    return mIsDigestMatched;
+  }
+
+  bool isCompleted(){
+    return mIsCompleted;
+  }
+
+  // true if the HAL failed to write the target. The session is completed with false then.
+  bool isWriteFailed(){
+    return mIsWriteFailed;
+  }
+
+  // the completion is posted to the executor instead of calling it in write()
+  void setCompletionExecutor(std::shared_ptr<IUpdateCompletionExecutor> pExecutor){
+    mExecutor = pExecutor;
+  }
+
+  // record the checkpoint to the journal every interval bytes. Only FULL is supported since the DELTA applier's state isn't recorded.
+  bool enableCheckpoint(std::string journalPath, uint64_t interval = 8*1024*1024){
+    if( mType != IUpdateSession::UpdateType::FULL ) return false;
+    mJournal = std::make_shared<UpdateSessionJournal>(journalPath);
+    mCheckpointInterval = interval;
+    return true;
+  }
+
+  // continue from the checkpoint recorded by the interrupted session. The HAL discards the data written after it.
+  bool restoreCheckpoint(std::string journalPath){
+    UpdateSessionJournal::Checkpoint checkpoint;
+    if( mWrittenSize || !UpdateSessionJournal(journalPath).load(checkpoint) ) return false;
+    if( checkpoint.type != (uint32_t)mType || checkpoint.maxSize != mMaxSize ) return false;
+    if( !checkpoint.expectedDigest.empty() ){
+      setExpectedDigest(checkpoint.expectedDigest);
+      if( !mDigest->restoreState(checkpoint.digestState) ) return false;
+    }
+    if( mConcreteHal && !mConcreteHal->resumeWrite(mId, checkpoint.writtenSize) ) return false;
+    mWrittenSize = checkpoint.writtenSize;
+    mChunkCount = checkpoint.chunkCount;
+    mCheckpointedSize = checkpoint.writtenSize;
+    updateProgress();
+    return true;
+  }
+
+  // push the progress every sizeInterval bytes or every timeInterval, whichever comes first. It's checked at each write().
+  // The callback is called on the writer's thread or posted to the completion executor.
+  int subscribeProgress(PROGRESS_CALLBACK callback, uint64_t sizeInterval = 1024*1024, std::chrono::milliseconds timeInterval = std::chrono::milliseconds(100)){
+    std::lock_guard<std::mutex> lock(mSubscriptionMutex);
+    int id = mNextSubscriptionId++;
+    mSubscriptions.push_back( ProgressSubscription{ id, callback, sizeInterval, timeInterval, mProgressSize.load(), std::chrono::steady_clock::now() } );
+    mHasSubscriptions.store(true, std::memory_order_release);
+    return id;
+  }
+
+  void unsubscribeProgress(int subscriptionId){
+    std::lock_guard<std::mutex> lock(mSubscriptionMutex);
+    std::erase_if(mSubscriptions, [subscriptionId](const ProgressSubscription& subscription){
+      return subscription.id == subscriptionId;
+    });
+    mHasSubscriptions.store(!mSubscriptions.empty(), std::memory_order_release);
+  }
+
+  // the snapshot which is safe to call from any thread
+  UpdateProgress getProgress(){
+    const uint64_t writtenSize = mProgressSize.load(std::memory_order_acquire);
+    const int64_t firstWriteTime = mFirstWriteTime.load(std::memory_order_acquire);
+    double throughput = 0.0;
+    if( firstWriteTime ){
+      double elapsedTime = std::chrono::duration<double>( std::chrono::steady_clock::now().time_since_epoch() - std::chrono::steady_clock::duration(firstWriteTime) ).count();
+      uint64_t firstWriteSize = mFirstWriteSize.load(std::memory_order_relaxed);
+      throughput = ( elapsedTime > 0.0 ) ? (double)( writtenSize - std::min(writtenSize, firstWriteSize) ) / elapsedTime : 0.0;
+    }
+    return UpdateProgress::estimate(writtenSize, mProgressTotalSize.load(std::memory_order_relaxed), throughput, mIsCompleted.load());
+  }
+
+  using IUpdateSession::write;
+  virtual bool write(std::span<const uint8_t> chunk){
+    // the write after the completion doesn't reach the HAL and the digest
+    if( mIsCompleted || ( mDeltaApplier ? mDeltaApplier->isCompleted() : mWrittenSize >= mMaxSize ) ){
+      if( mCompletion ){
+        throw IllegalInvocationException("Already done to update");
+      }
+      return false;
+    }
+    if( !mFirstWriteTime.load(std::memory_order_relaxed) ){
+      mFirstWriteSize.store(mProgressSize.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      mFirstWriteTime.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_release);
+    }
+    bool result;
+    if( mDeltaApplier ){
+      mDeltaApplier->write(chunk);
+      mWrittenSize += chunk.size();
+      result = !mDeltaApplier->isCompleted() && !mIsWriteFailed;
+    } else {
+      writeTarget(chunk);
+      mWrittenSize += chunk.size();
+      mChunkCount++;
+      result = mWrittenSize < mMaxSize && !mIsWriteFailed;
+      if( mJournal ){
+        if( mIsWriteFailed ){
+          // keep the journal to resume from the last checkpoint
+        } else if( !result ){
+          mJournal->remove();
+        } else if( mWrittenSize - mCheckpointedSize >= mCheckpointInterval ){
+          checkpoint();
+        }
+      }
+    }
+    updateProgress();
+    if( !result && !mIsCompleted ){
+      // the completion is called with false on the HAL's write failure
+      bool isSuccessfullyDone = !mIsWriteFailed && verifyDigest();
+      mIsCompleted = true;
+      if( mCompletion && mExecutor ){
+        mExecutor->post([completion = mCompletion, id = mId, isSuccessfullyDone](){
+          completion(id, isSuccessfullyDone);
+        });
+      } else if( mCompletion ){
+        mCompletion(mId, isSuccessfullyDone);
+      }
+    }
+    notifyProgress(!result);
+    return result;
+  }
+
+  virtual float getProgressPercent(){
+    const uint64_t totalSize = mProgressTotalSize.load(std::memory_order_relaxed);
+    return totalSize ? std::min(100.0f, (float)mProgressSize.load(std::memory_order_acquire)/(float)totalSize*100.0f) : 0.0f;
+  }
+
+  virtual uint64_t getWrittenSize(){
+    return mWrittenSize;
+  }
+
+  virtual bool cancel(){
+    if( mIsCompleted ) return false;
+    mWrittenSize = 0;
+    mFirstWriteTime = 0;
+    mChunkCount = 0;
+    mCheckpointedSize = 0;
+    if( mDigest ){
+      mDigest->reset();
+    }
+    if( mJournal ){
+      mJournal->remove();
+    }
+    resetDeltaApplier();
+    updateProgress();
+    return true;
+  }
+};
+
+
+#if USE_PLUGIN
+// git clone https://github.com/hidenorly/plugin-manager.git
+#include "../plugin-manager/include/PlugInManager.hpp"
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <dlfcn.h>
+
+class UpdaterPlugInBase : public IPlugIn, public IConcreteUpdateHal
+{
+public:
+    UpdaterPlugInBase(){};
+    virtual ~UpdaterPlugInBase(){};
+
+    /* @desc initialize at loading the  plug-in shared object such as .so */
+    virtual void onLoad(void){};
+    /* @desc uninitialize at unloading the  plug-in shared object such as .so */
+    virtual void onUnload(void){};
+    /* @desc report your  plug-in's unique id
+        @return unique plug-in id. may use uuid. */
+    virtual std::string getId(void){return "nothing";};
+    /* @desc report plugin type
+     @return plug-in type. */
+      virtual std::string getType(void){ return "UpdaterPlugInBase"; };
+    /* @desc this is expected to use by strategy
+        @return new YourConcreteClass()'s instanciated result */
+    virtual IPlugIn* newInstance(void) = 0;
+    virtual std::string toString(void){ return "NoPlugIn"; };
+    /* @desc capability report if this plug-in can support this device
+       @return true if current running device matches this plug-in */
+    virtual bool canHandle(void){ return true; };
+};
+
+typedef TPlugInManager<UpdaterPlugInBase> UpdaterPlugInManager;
+
+// --- plug-in discovery without loading them.
+//     The supported ids are read from the manifest (e.g. libfoo.so.ids : an id per line) or probed once by loading the plug-in.
+//     The result is cached to the disk and is reused while the plug-in file's mtime and size are unchanged.
+class UpdaterPlugInDiscovery
+{
+public:
+  static constexpr const char* MANIFEST_SUFFIX = ".ids";
+  static constexpr const char* DEFAULT_CACHE_NAME = ".updater_plugin.cache";
+  static constexpr const char* CACHE_HEADER = "UPDATER_PLUGIN_CACHE 1";
+  // the entry point exported by the plug-in such as MockUpdaterPlugIn.cxx. It's the same one which the plug-in manager resolves.
+  static constexpr const char* ENTRY_POINT = "getPlugInInstance";
+
+  struct PlugInInfo
+  {
+    std::string path;
+    int64_t modifiedTime;
+    uint64_t fileSize;
+    bool canHandle;
+    std::vector<std::string> ids;
+  };
+
+protected:
+  std::string mPlugInPath;
+  std::string mCachePath;
+
+  static bool isPlugInFile(const std::filesystem::path& path){
+    return path.extension() == ".so" || path.extension() == ".dylib";
+  }
+
+  static std::vector<std::string> split(const std::string& text, char delimiter){
+    std::vector<std::string> result;
+    std::string token;
+    std::istringstream stream(text);
+    while( std::getline(stream, token, delimiter) ){
+      if( !token.empty() ) result.push_back(token);
+    }
+    return result;
+  }
+
+  static bool readManifest(PlugInInfo& info){
+    std::ifstream stream(info.path + MANIFEST_SUFFIX);
+    if( !stream ) return false;
+    std::string id;
+    while( std::getline(stream, id) ){
+      if( !id.empty() && id[0] != '#' ) info.ids.push_back(id);
+    }
+    return true;
+  }
+
+  // canHandle() is checked at the loading if the ids are from the manifest
+  static void probe(PlugInInfo& info){
+    auto pPlugIn = load(info.path);
+    info.canHandle = ( pPlugIn != nullptr );
+    if( pPlugIn ){
+      info.ids = pPlugIn->getSupportedIds();
+    }
+  }
+
+  std::map<std::string, PlugInInfo> loadCache(){
+    std::map<std::string, PlugInInfo> result;
+    std::ifstream stream(mCachePath);
+    std::string line;
+    if( !std::getline(stream, line) || line != CACHE_HEADER ) return result;
+    while( std::getline(stream, line) ){
+      // path \t mtime \t size \t canHandle \t id,id,...
+      std::vector<std::string> fields;
+      std::istringstream lineStream(line);
+      for(std::string field; std::getline(lineStream, field, '\t'); ){
+        fields.push_back(field);
+      }
+      if( fields.size() < 4 ) continue;
+      try{
+        result[fields[0]] = PlugInInfo{ fields[0], std::stoll(fields[1]), std::stoull(fields[2]), fields[3] == "1", fields.size() > 4 ? split(fields[4], ',') : std::vector<std::string>() };
+      } catch (std::exception& ex){
+        // the broken entry is probed again
+      }
+    }
+    return result;
+  }
+
+  void saveCache(const std::vector<PlugInInfo>& infos){
+    std::string tempPath = mCachePath + ".tmp";
+    {
+      std::ofstream stream(tempPath, std::ios::trunc);
+      stream << CACHE_HEADER << "\n";
+      for(auto& info : infos){
+        stream << info.path << "\t" << info.modifiedTime << "\t" << info.fileSize << "\t" << (info.canHandle ? "1" : "0") << "\t";
+        for(size_t i = 0; i < info.ids.size(); i++){
+          stream << (i ? "," : "") << info.ids[i];
+        }
+        stream << "\n";
+      }
+      if( !stream ) return;
+    }
+    std::error_code error;
+    std::filesystem::rename(tempPath, mCachePath, error);
+  }
+
+  static int64_t getModifiedTime(const std::filesystem::path& path){
+    std::error_code error;
+    auto time = std::filesystem::last_write_time(path, error);
+    return error ? std::numeric_limits<int64_t>::min() : time.time_since_epoch().count();
+  }
+
+public:
+  UpdaterPlugInDiscovery(std::string plugInPath = ".", std::string cachePath = ""):mPlugInPath(plugInPath), mCachePath(cachePath.empty() ? plugInPath + "/" + DEFAULT_CACHE_NAME : cachePath){}
+  virtual ~UpdaterPlugInDiscovery(){}
+
+  // the plug-ins in the plug-in path. The changed plug-ins are examined in parallel.
+  std::vector<PlugInInfo> discover(size_t threadCount = std::thread::hardware_concurrency()){
+    std::vector<PlugInInfo> infos;
+    std::error_code error;
+    for(auto& entry : std::filesystem::directory_iterator(mPlugInPath, error)){
+      if( entry.is_regular_file(error) && isPlugInFile(entry.path()) ){
+        // the manifest's update invalidates the cache as well
+        int64_t modifiedTime = std::max( getModifiedTime(entry.path()), getModifiedTime(entry.path().string() + MANIFEST_SUFFIX) );
+        infos.push_back( PlugInInfo{ entry.path().string(), modifiedTime, (uint64_t)entry.file_size(error), true, {} } );
+      }
+    }
+
+    auto cache = loadCache();
+    std::vector<PlugInInfo*> pendings;
+    for(auto& info : infos){
+      auto it = cache.find(info.path);
+      if( it != cache.end() && it->second.modifiedTime == info.modifiedTime && it->second.fileSize == info.fileSize ){
+        info = it->second;
+      } else {
+        pendings.push_back(&info);
+      }
+    }
+
+    std::atomic<size_t> next = 0;
+    std::vector<std::thread> threads;
+    for(size_t i = 0; i < std::min(std::max<size_t>(1, threadCount), pendings.size()); i++){
+      threads.push_back( std::thread([&](){
+        for(size_t index; (index = next++) < pendings.size(); ){
+          if( !readManifest(*pendings[index]) ){
+            probe(*pendings[index]);
+          }
+        }
+      }) );
+    }
+    for(auto& thread : threads){
+      thread.join();
+    }
+
+    if( !pendings.empty() || cache.size() != infos.size() ){
+      saveCache(infos);
+    }
+    return infos;
+  }
+
+  // load the plug-in. nullptr if it can't be loaded or it doesn't handle this device. The plug-in is unloaded with the last reference.
+  // The single plug-in is loaded here since the plug-in manager loads all of the plug-ins in its path at once.
+  static std::shared_ptr<UpdaterPlugInBase> load(std::string path){
+    void* pHandle = ::dlopen(path.c_str(), RTLD_NOW | RTLD_GLOBAL);
+    if( !pHandle ) return nullptr;
+    auto getPlugInInstance = reinterpret_cast<void* (*)(void)>( ::dlsym(pHandle, ENTRY_POINT) );
+    IPlugIn* pInstance = getPlugInInstance ? reinterpret_cast<IPlugIn*>( getPlugInInstance() ) : nullptr;
+    UpdaterPlugInBase* pPlugIn = dynamic_cast<UpdaterPlugInBase*>( pInstance );
+    if( !pPlugIn ){
+      // the other kind of plug-in is deleted before its code is unmapped
+      delete pInstance;
+      ::dlclose(pHandle);
+      return nullptr;
+    }
+    pPlugIn->onLoad();
+    std::shared_ptr<UpdaterPlugInBase> result(pPlugIn, [pHandle](UpdaterPlugInBase* pPlugIn){
+      pPlugIn->onUnload();
+      delete pPlugIn;
+      ::dlclose(pHandle);
+    });
+    return result->canHandle() ? result : nullptr;
+  }
+};
+#endif // USE_PLUGIN
+
+
+// --- the concrete HAL instantiated at the first use such as the plug-in loaded on demand
+class UpdateLazyConcreteHal
+{
+public:
+  typedef std::function<std::shared_ptr<IConcreteUpdateHal>(void)> FACTORY;
+
+protected:
+  FACTORY mFactory;
+  std::once_flag mOnce;
+  std::shared_ptr<IConcreteUpdateHal> mInstance;
+
+public:
+  UpdateLazyConcreteHal(FACTORY factory):mFactory(factory){}
+  virtual ~UpdateLazyConcreteHal(){}
+
+  // nullptr if the factory failed
+  const std::shared_ptr<IConcreteUpdateHal>& get(){
+    std::call_once(mOnce, [this](){
+      mInstance = mFactory();
+      mFactory = nullptr;
+    });
+    return mInstance;
+  }
+};
+
+
+// the interned subsystem id. resolve() the id once then dispatch by the handle without the string lookup.
+struct SubsystemHandle
+{
+  static constexpr uint32_t INVALID_INDEX = UINT32_MAX;
+  uint32_t index = INVALID_INDEX;
+
+  bool isValid() const {
+    return index != INVALID_INDEX;
+  }
+};
+
+
+// --- default impl. of IUpdateInstallHal ---
+//     Note that this delegates to instance of IConcreteUpdateHal
+
+class UpdateInstallHalImpl : public IUpdateInstallHal
+{
+protected:
+    struct Subsystem
+    {
+      std::string id;
+      std::shared_ptr<IConcreteUpdateHal> hal;
+      std::shared_ptr<UpdateLazyConcreteHal> lazyHal;
+      std::weak_ptr<UpdateSessionImpl> session;
+
+      bool isRegistered() const {
+        return hal || lazyHal;
+      }
+
+      // instantiate the lazy HAL at the first use
+      const std::shared_ptr<IConcreteUpdateHal>& getHal(){
+        return ( hal || !lazyHal ) ? hal : lazyHal->get();
+      }
+    };
+    // the handle is the index of mSubsystems. The subsystems are registered before dispatching.
+    std::vector<Subsystem> mSubsystems;
+    std::map<std::string, uint32_t, std::less<>> mHandles;
+    std::mutex mSessionMutex;
+    std::string mJournalDirectory;
+    uint64_t mCheckpointInterval;
+    std::shared_ptr<IUpdateCompletionExecutor> mExecutor;
+
+    // the completion called by the concrete HAL is posted to the executor
+    IUpdateCore::COMPLETION_CALLBACK wrapCompletion(IUpdateCore::COMPLETION_CALLBACK completion){
+      if( !mExecutor || !completion ) return completion;
+      return [pExecutor = mExecutor, completion](std::string id, bool isSuccessfullyDone){
+        pExecutor->post([completion, id, isSuccessfullyDone](){
+          completion(id, isSuccessfullyDone);
+        });
+      };
+    }
+
+    // run the operation on the executor. The future has the result of the completion or the thrown exception.
+    std::future<bool> postOperation(std::function<void(IUpdateCore::COMPLETION_CALLBACK)> operation){
+      auto pPromise = std::make_shared<std::promise<bool>>();
+      auto pIsSet = std::make_shared<std::atomic<bool>>(false);
+      std::future<bool> result = pPromise->get_future();
+      auto task = [operation, pPromise, pIsSet](){
+        try{
+          operation([pPromise, pIsSet](std::string id, bool isSuccessfullyDone){
+            if( !pIsSet->exchange(true) ){
+              pPromise->set_value(isSuccessfullyDone);
+            }
+          });
+        } catch (...) {
+          if( !pIsSet->exchange(true) ){
+            pPromise->set_exception(std::current_exception());
+          }
+        }
+      };
+      if( mExecutor ){
+        mExecutor->post(task);
+      } else {
+        task();
+      }
+      return result;
+    }
+
+    std::future<bool> getBadIdFuture(std::string id){
+      std::promise<bool> promise;
+      promise.set_exception( std::make_exception_ptr( InvalidArgumentException( createMessageId(id) ) ) );
+      return promise.get_future();
+    }
+
+    Subsystem* getSubsystem(SubsystemHandle handle){
+      return ( handle.index < mSubsystems.size() && mSubsystems[handle.index].isRegistered() ) ? &mSubsystems[handle.index] : nullptr;
+    }
+
+    Subsystem& getSubsystemOrThrow(SubsystemHandle handle){
+      Subsystem* pSubsystem = getSubsystem(handle);
+      if( !pSubsystem ){
+        throw InvalidArgumentException( std::string("The handle ") + std::to_string(handle.index) + " isn't valid" );
+      }
+      if( !pSubsystem->getHal() ){
+        throw IllegalStateException( std::string("The id ") + pSubsystem->id + " failed to load the HAL" );
+      }
+      return *pSubsystem;
+    }
+
+    Subsystem& getOrAddSubsystem(std::string id){
+      auto it = mHandles.find(id);
+      if( it == mHandles.end() ){
+        it = mHandles.emplace(id, mSubsystems.size()).first;
+        mSubsystems.push_back( Subsystem{ id, nullptr, nullptr, {} } );
+      }
+      return mSubsystems[it->second];
+    }
+
+    std::string getJournalPath(std::string id){
+      return mJournalDirectory + "/" + id + ".journal";
+    }
+
+    // the streamed digest, the checkpoint and the registration for validate()
+    void prepareSession(Subsystem& subsystem, std::shared_ptr<IUpdateSession> session, IUpdateSession::UpdateType type, bool isResumed){
+      auto pSession = std::dynamic_pointer_cast<UpdateSessionImpl>(session);
+      if( pSession && type != IUpdateSession::UpdateType::FULL ){
+        std::lock_guard<std::mutex> lock(mSessionMutex);
+        subsystem.session = pSession;
+      } else if( pSession ){
+        // verify the FULL image while writing if META_HASH is SHA-256. The resumed session restores it from the journal.
+        auto meta = subsystem.getHal()->getMetaDataById(subsystem.id);
+        if( !isResumed && meta.contains(META_HASH) && meta[META_HASH].size() == Sha256Digest::DIGEST_SIZE * 2 ){
+          pSession->setExpectedDigest( meta[META_HASH] );
+        }
+        if( !mJournalDirectory.empty() ){
+          pSession->enableCheckpoint( getJournalPath(subsystem.id), mCheckpointInterval );
+        }
+        std::lock_guard<std::mutex> lock(mSessionMutex);
+        subsystem.session = pSession;
+      }
+    }
+
+public:
+  UpdateInstallHalImpl():mCheckpointInterval(0){
+#if USE_PLUGIN
+    // the plug-in is loaded when its subsystem is touched at the first time
+    UpdaterPlugInDiscovery discovery(".");
+    for(auto& info : discovery.discover()){
+      if( info.canHandle && !info.ids.empty() ){
+        std::string path = info.path;
+        registerConcreteHal(info.ids, [path](){
+          return std::static_pointer_cast<IConcreteUpdateHal>( UpdaterPlugInDiscovery::load(path) );
+        });
+      }
+    }
+#endif // USE_PLUGIN
+  }
+  virtual ~UpdateInstallHalImpl(){
+  }
+
+  virtual std::vector<std::string> getSupportedIds(){
+    std::vector<std::string> ids;
+    for( auto& [id, index] : mHandles ){
+      if( mSubsystems[index].isRegistered() ){
+        ids.push_back(id);
+      }
+    }
+    return ids;
+  }
+
+  // register the concrete HAL for its supported ids such as the built-in HAL.
+  // The re-registered id keeps its handle.
+  void registerConcreteHal(std::shared_ptr<IConcreteUpdateHal> pHal){
+    for(auto& id : pHal->getSupportedIds()){
+      Subsystem& subsystem = getOrAddSubsystem(id);
+      subsystem.hal = pHal;
+      subsystem.lazyHal = nullptr;
+    }
+  }
+
+  // register the ids whose concrete HAL is instantiated by the factory at the first use. The ids share the instance.
+  void registerConcreteHal(std::vector<std::string> ids, UpdateLazyConcreteHal::FACTORY factory){
+    auto pLazyHal = std::make_shared<UpdateLazyConcreteHal>(factory);
+    for(auto& id : ids){
+      Subsystem& subsystem = getOrAddSubsystem(id);
+      subsystem.hal = nullptr;
+      subsystem.lazyHal = pLazyHal;
+    }
+  }
+
+  // record the checkpoints of the sessions to the directory every interval bytes for resumeUpdateSession()
+  void setJournalDirectory(std::string directory, uint64_t interval = 8*1024*1024){
+    mJournalDirectory = directory;
+    mCheckpointInterval = interval;
+  }
+
+  // post the completions to the executor such as UpdateThreadPool. nullptr calls them synchronously.
+  // The executor has to finish the posted tasks before this is destroyed.
+  void setCompletionExecutor(std::shared_ptr<IUpdateCompletionExecutor> pExecutor){
+    mExecutor = pExecutor;
+  }
+
+  std::shared_ptr<IUpdateCompletionExecutor> getCompletionExecutor(){
+    return mExecutor;
+  }
+
+  // the overall progress of the alive sessions. The throughput is the sum of the sessions in progress
+  // then the remaining time is estimated for both of the parallel and the sequential updates.
+  UpdateProgress getAggregateProgress(){
+    uint64_t writtenSize = 0;
+    uint64_t totalSize = 0;
+    double throughput = 0.0;
+    bool isCompleted = true;
+    bool isTotalSizeKnown = true;
+    std::vector<std::shared_ptr<UpdateSessionImpl>> sessions;
+    {
+      std::lock_guard<std::mutex> lock(mSessionMutex);
+      for(auto& subsystem : mSubsystems){
+        if( auto pSession = subsystem.session.lock() ){
+          sessions.push_back(pSession);
+        }
+      }
+    }
+    for(auto& pSession : sessions){
+      UpdateProgress progress = pSession->getProgress();
+      writtenSize += progress.writtenSize;
+      totalSize += progress.totalSize;
+      isTotalSizeKnown = isTotalSizeKnown && progress.totalSize;
+      isCompleted = isCompleted && progress.isCompleted;
+      if( !progress.isCompleted ){
+        throughput += progress.throughput;
+      }
+    }
+    UpdateProgress result = UpdateProgress::estimate(writtenSize, totalSize, throughput, isCompleted && !sessions.empty());
+    if( !isTotalSizeKnown && !result.isCompleted ){
+      result.remainingTime = -1.0;
+    }
+    return result;
+  }
+
+  // intern the id. The handle isn't valid if the id isn't supported.
+  SubsystemHandle resolve(std::string_view id){
+    auto it = mHandles.find(id);
+    return ( it != mHandles.end() && mSubsystems[it->second].isRegistered() ) ? SubsystemHandle{ it->second } : SubsystemHandle();
+  }
+
+  std::string getId(SubsystemHandle handle){
+    return getSubsystemOrThrow(handle).id;
+  }
+
+  // --- handle API. InvalidArgumentException if the handle isn't valid.
+  // the concrete HAL which handles the id. The ids handled by the same HAL share the instance.
+  std::shared_ptr<IConcreteUpdateHal> getConcreteHal(SubsystemHandle handle){
+    Subsystem* pSubsystem = getSubsystem(handle);
+    return pSubsystem ? pSubsystem->getHal() : nullptr;
+  }
+
+  std::map<std::string, std::string> getMetaDataById(SubsystemHandle handle){
+    Subsystem& subsystem = getSubsystemOrThrow(handle);
+    return subsystem.getHal()->getMetaDataById(subsystem.id);
+  }
+
+  std::shared_ptr<IUpdateSession> startUpdateSession(SubsystemHandle handle, IUpdateCore::COMPLETION_CALLBACK completion, IUpdateSession::UpdateType type = IUpdateSession::UpdateType::FULL){
+    Subsystem& subsystem = getSubsystemOrThrow(handle);
+    if( !subsystem.getHal()->canStartUpdateSession(subsystem.id, type) ){
+      std::string msg = createMessageId(subsystem.id);
+      msg += " on ";
+      msg += ( (type == IUpdateSession::UpdateType::FULL) ? "FULL" : "DELTA" );
+      throw IllegalStateException(msg);
+    }
+    std::shared_ptr<IUpdateSession> result = subsystem.getHal()->startUpdateSession( subsystem.id, wrapCompletion(completion), type );
+    prepareSession(subsystem, result, type, false);
+    return result;
+  }
+
+  std::shared_ptr<IUpdateSession> resumeUpdateSession(SubsystemHandle handle, IUpdateCore::COMPLETION_CALLBACK completion){
+    Subsystem& subsystem = getSubsystemOrThrow(handle);
+    std::shared_ptr<IUpdateSession> result = subsystem.getHal()->resumeUpdateSession( subsystem.id, wrapCompletion(completion) );
+    auto pSession = std::dynamic_pointer_cast<UpdateSessionImpl>(result);
+    if( mJournalDirectory.empty() || !pSession || !pSession->restoreCheckpoint( getJournalPath(subsystem.id) ) ){
+      throw IllegalStateException( std::string("The id ") + subsystem.id + " doesn't have the checkpoint to resume" );
+    }
+    prepareSession(subsystem, result, IUpdateSession::UpdateType::FULL, true);
+    return result;
+  }
+
+  float getProgressPercent(SubsystemHandle handle){
+    Subsystem& subsystem = getSubsystemOrThrow(handle);
+    return subsystem.getHal()->getProgressPercent(subsystem.id);
+  }
+
+  void validate(SubsystemHandle handle, IUpdateCore::COMPLETION_CALLBACK completion){
+    Subsystem& subsystem = getSubsystemOrThrow(handle);
+    completion = wrapCompletion(completion);
+    std::shared_ptr<UpdateSessionImpl> pSession;
+    {
+      std::lock_guard<std::mutex> lock(mSessionMutex);
+      pSession = subsystem.session.lock();
+    }
+    if( pSession && pSession->isDigestVerified() ){
+      // already verified while writing. Don't read the written image again.
+      completion(subsystem.id, pSession->isDigestMatched());
+    } else {
+      subsystem.getHal()->validate(subsystem.id, completion);
+    }
+  }
+
+  void activateForNext(SubsystemHandle handle, IUpdateCore::COMPLETION_CALLBACK completion){
+    Subsystem& subsystem = getSubsystemOrThrow(handle);
+    subsystem.getHal()->activateForNext(subsystem.id, wrapCompletion(completion));
+  }
+
+  void restartAndWaitToBoot(SubsystemHandle handle, IUpdateCore::COMPLETION_CALLBACK completion){
+    Subsystem& subsystem = getSubsystemOrThrow(handle);
+    subsystem.getHal()->restartAndWaitToBoot(subsystem.id, wrapCompletion(completion));
+  }
+
+  // --- future API : the HAL operation runs on the executor then the caller isn't blocked
+  std::future<bool> validateAsync(SubsystemHandle handle){
+    return postOperation([this, handle](IUpdateCore::COMPLETION_CALLBACK completion){ validate(handle, completion); });
+  }
+
+  std::future<bool> activateForNextAsync(SubsystemHandle handle){
+    return postOperation([this, handle](IUpdateCore::COMPLETION_CALLBACK completion){ activateForNext(handle, completion); });
+  }
+
+  std::future<bool> restartAndWaitToBootAsync(SubsystemHandle handle){
+    return postOperation([this, handle](IUpdateCore::COMPLETION_CALLBACK completion){ restartAndWaitToBoot(handle, completion); });
+  }
+
+  std::future<bool> validateAsync(std::string id){
+    SubsystemHandle handle = resolve(id);
+    return handle.isValid() ? validateAsync(handle) : getBadIdFuture(id);
+  }
+
+  std::future<bool> activateForNextAsync(std::string id){
+    SubsystemHandle handle = resolve(id);
+    return handle.isValid() ? activateForNextAsync(handle) : getBadIdFuture(id);
+  }
+
+  std::future<bool> restartAndWaitToBootAsync(std::string id){
+    SubsystemHandle handle = resolve(id);
+    return handle.isValid() ? restartAndWaitToBootAsync(handle) : getBadIdFuture(id);
+  }
+
+  // --- string API : resolve() then dispatch by the handle
+  virtual std::shared_ptr<IConcreteUpdateHal> getConcreteHal(std::string id){
+    return getConcreteHal( resolve(id) );
+  }
+
+  virtual std::map<std::string, std::string> getMetaDataById(std::string id){
+    SubsystemHandle handle = resolve(id);
+    return handle.isValid() ? getMetaDataById(handle) : std::map<std::string, std::string>({});
+  }
+
+  virtual std::shared_ptr<IUpdateSession> startUpdateSession(std::string id, IUpdateCore::COMPLETION_CALLBACK completion, IUpdateSession::UpdateType type = IUpdateSession::UpdateType::FULL){
+    SubsystemHandle handle = resolve(id);
+    if( !handle.isValid() ){
+      throwBadId(id);
+    }
+    return startUpdateSession(handle, completion, type);
+  }
+
+  virtual std::shared_ptr<IUpdateSession> resumeUpdateSession(std::string id, IUpdateCore::COMPLETION_CALLBACK completion){
+    SubsystemHandle handle = resolve(id);
+    if( !handle.isValid() ){
+      throwBadId(id);
+    }
+    return resumeUpdateSession(handle, completion);
+  }
+
+  float getProgressPercent(std::string id){
+    SubsystemHandle handle = resolve(id);
+    return handle.isValid() ? getProgressPercent(handle) : 0.0f;
+  }
+
+  virtual void validate(std::string id, IUpdateCore::COMPLETION_CALLBACK completion){
+    SubsystemHandle handle = resolve(id);
+    if( handle.isValid() ){
+      validate(handle, completion);
+    } else {
+      completion(id, true);
+      throwBadId(id);
+    }
+  }
+
+  virtual void activateForNext(std::string id, IUpdateCore::COMPLETION_CALLBACK completion){
+    SubsystemHandle handle = resolve(id);
+    if( handle.isValid() ){
+      activateForNext(handle, completion);
+    } else {
+      completion(id, true);
+      throwBadId(id);
+    }
+  }
+
+  virtual void restartAndWaitToBoot(std::string id, IUpdateCore::COMPLETION_CALLBACK completion){
+    SubsystemHandle handle = resolve(id);
+    if( handle.isValid() ){
+      restartAndWaitToBoot(handle, completion);
+    } else {
+      completion(id, true);
+      throwBadId(id);
+    }
+  }
+};
+
+
+// --- pipelined writer : overlap reading the image, hashing and writing with the fixed number of the reusable buffers.
+//     The peak memory is chunkSize * bufferCount regardless of the image size.
+class UpdateWritePipeline
+{
+public:
+  // fill the buffer and return the filled size. 0 at the end of the image.
+  typedef std::function<size_t(std::span<uint8_t> buffer)> READER;
+  // called in the order of the chunks
+  typedef std::function<void(std::span<const uint8_t> chunk)> HASHER;
+
+protected:
+  struct Buffer
+  {
+    std::vector<uint8_t> data;
+    size_t size;
+  };
+
+  // nullptr is the end of the stream
+  class BufferQueue
+  {
+  protected:
+    std::deque<Buffer*> mQueue;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+
+  public:
+    void push(Buffer* pBuffer){
+      {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQueue.push_back(pBuffer);
+      }
+      mCondition.notify_one();
+    }
+    Buffer* pop(){
+      std::unique_lock<std::mutex> lock(mMutex);
+      mCondition.wait(lock, [&](){ return !mQueue.empty(); });
+      Buffer* result = mQueue.front();
+      mQueue.pop_front();
+      return result;
+    }
+  };
+
+  const size_t mChunkSize;
+  std::vector<Buffer> mBuffers;
+
+public:
+  UpdateWritePipeline(size_t chunkSize = 1024*1024, size_t bufferCount = 4):mChunkSize(chunkSize), mBuffers(bufferCount){
+    for(auto& buffer : mBuffers){
+      buffer.data.resize(chunkSize);
+      buffer.size = 0;
+    }
+  }
+  virtual ~UpdateWritePipeline(){}
+
+  // write the image read by the reader into the session. Blocks until the end of the image.
+  // The exception thrown by the stages is re-thrown here after stopping the pipeline.
+  size_t run(std::shared_ptr<IUpdateSession> pSession, READER reader, HASHER hasher = nullptr){
+    BufferQueue freeQueue, hashQueue, writeQueue;
+    for(auto& buffer : mBuffers){
+      freeQueue.push(&buffer);
+    }
+    std::exception_ptr pException;
+    std::mutex exceptionMutex;
+    std::atomic<bool> isFailed(false);
+    auto setException = [&](){
+      std::lock_guard<std::mutex> lock(exceptionMutex);
+      if( !pException ){
+        pException = std::current_exception();
+      }
+      isFailed = true;
+    };
+
+    std::thread hashThread;
+    if( hasher ){
+      hashThread = std::thread([&](){
+        while( Buffer* pBuffer = hashQueue.pop() ){
+          if( !isFailed ){
+            try{
+              hasher(std::span<const uint8_t>(pBuffer->data.data(), pBuffer->size));
+            } catch (...) {
+              setException();
+            }
+          }
+          writeQueue.push(pBuffer);
+        }
+        writeQueue.push(nullptr);
+      });
+    }
+
+    size_t writtenSize = 0;
+    std::thread writeThread([&](){
+      while( Buffer* pBuffer = writeQueue.pop() ){
+        if( !isFailed ){
+          try{
+            pSession->write(std::span<const uint8_t>(pBuffer->data.data(), pBuffer->size));
+            writtenSize += pBuffer->size;
+          } catch (...) {
+            setException();
+          }
+        }
+        freeQueue.push(pBuffer);
+      }
+    });
+
+    // read in this thread
+    BufferQueue& nextQueue = hasher ? hashQueue : writeQueue;
+    while( !isFailed ){
+      Buffer* pBuffer = freeQueue.pop();
+      try{
+        pBuffer->size = reader(std::span<uint8_t>(pBuffer->data.data(), mChunkSize));
+      } catch (...) {
+        setException();
+        pBuffer->size = 0;
+      }
+      if( !pBuffer->size ){
+        freeQueue.push(pBuffer);
+        break;
+      }
+      nextQueue.push(pBuffer);
+    }
+    nextQueue.push(nullptr);
+
+    if( hashThread.joinable() ){
+      hashThread.join();
+    }
+    writeThread.join();
+    if( pException ){
+      std::rethrow_exception(pException);
+    }
+    return writtenSize;
+  }
+
+  size_t getPeakMemorySize(){
+    return mChunkSize * mBuffers.size();
+  }
+};
+
+
+// --- orchestrator : update the multiple subsystems in parallel.
+//     Each target runs WRITE -> VALIDATE -> ACTIVATE (-> RESTART). The targets on the different concrete HALs run in parallel
+//     and the targets on the same concrete HAL run up to its concurrency limit (1 by default).
+//     addDependency() adds the cross-target order such as "activate mcu_1 only after system validates".
+class UpdateOrchestrator
+{
+public:
+  enum class Stage {
+    WRITE,
+    VALIDATE,
+    ACTIVATE,
+    RESTART,
+  };
+
+  typedef std::function<void(std::string id, Stage stage, bool isSuccessfullyDone)> STAGE_CALLBACK;
+
+  static const char* getStageName(Stage stage){
+    switch( stage ){
+      case Stage::WRITE: return "WRITE";
+      case Stage::VALIDATE: return "VALIDATE";
+      case Stage::ACTIVATE: return "ACTIVATE";
+      case Stage::RESTART: return "RESTART";
+    }
+    return "";
+  }
+
+protected:
+  enum class NodeState {
+    WAITING,
+    RUNNING,
+    SUCCEEDED,
+    FAILED,
+  };
+
+  struct Node
+  {
+    std::string id;
+    Stage stage;
+    IConcreteUpdateHal* pHal;
+    std::vector<size_t> dependents;
+    int pendingCount;
+    NodeState state;
+  };
+
+  struct Target
+  {
+    UpdateWritePipeline::READER reader;
+    IUpdateSession::UpdateType type;
+  };
+
+  std::shared_ptr<UpdateInstallHalImpl> mHal;
+  const size_t mThreadCount;
+  const int mDefaultConcurrency;
+  const size_t mChunkSize;
+  const size_t mBufferCount;
+  std::map<std::string, Target> mTargets;
+  std::vector<Node> mNodes;
+  std::map<std::pair<std::string, Stage>, size_t> mNodeIndexes;
+  std::map<IConcreteUpdateHal*, int> mConcurrencyLimits;
+  std::map<IConcreteUpdateHal*, int> mRunningCounts;
+  std::deque<size_t> mReadyNodes;
+  size_t mRemainingCount;
+  std::mutex mMutex;
+  std::condition_variable mCondition;
+  STAGE_CALLBACK mStageCallback;
+  std::shared_ptr<UpdateThreadPool> mPool;
+
+  size_t addNode(std::string id, Stage stage, IConcreteUpdateHal* pHal){
+    mNodes.push_back( Node{ id, stage, pHal, {}, 0, NodeState::WAITING } );
+    mNodeIndexes[ {id, stage} ] = mNodes.size() - 1;
+    return mNodes.size() - 1;
+  }
+
+  void addEdge(size_t from, size_t to){
+    mNodes[from].dependents.push_back(to);
+    mNodes[to].pendingCount++;
+  }
+
+  size_t getNodeIndex(std::string id, Stage stage){
+    auto it = mNodeIndexes.find( {id, stage} );
+    if( it == mNodeIndexes.end() ){
+      std::string msg = "The stage ";
+      msg += getStageName(stage);
+      msg += " of ";
+      msg += id;
+      msg += " isn't added";
+      throw InvalidArgumentException(msg);
+    }
+    return it->second;
+  }
+
+  bool hasCycle(){
+    std::vector<int> pendingCounts;
+    std::deque<size_t> readyNodes;
+    for(size_t i = 0; i < mNodes.size(); i++){
+      pendingCounts.push_back( mNodes[i].pendingCount );
+      if( !pendingCounts[i] ){
+        readyNodes.push_back(i);
+      }
+    }
+    size_t visitedCount = 0;
+    while( !readyNodes.empty() ){
+      size_t i = readyNodes.front();
+      readyNodes.pop_front();
+      visitedCount++;
+      for(auto dependent : mNodes[i].dependents){
+        if( !--pendingCounts[dependent] ){
+          readyNodes.push_back(dependent);
+        }
+      }
+    }
+    return visitedCount != mNodes.size();
+  }
+
+  // with mMutex
+  void dispatch(){
+    for(auto it = mReadyNodes.begin(); it != mReadyNodes.end(); ){
+      size_t index = *it;
+      IConcreteUpdateHal* pHal = mNodes[index].pHal;
+      int limit = mConcurrencyLimits.contains(pHal) ? mConcurrencyLimits[pHal] : mDefaultConcurrency;
+      if( mRunningCounts[pHal] < limit ){
+        mRunningCounts[pHal]++;
+        mNodes[index].state = NodeState::RUNNING;
+        it = mReadyNodes.erase(it);
+        mPool->post([this, index](){ execute(index); });
+      } else {
+        it++;
+      }
+    }
+  }
+
+  // with mMutex. The dependents of the failed node are failed without running.
+  void fail(size_t index){
+    if( mNodes[index].state == NodeState::FAILED ) return;
+    mNodes[index].state = NodeState::FAILED;
+    mRemainingCount--;
+    for(auto dependent : mNodes[index].dependents){
+      fail(dependent);
+    }
+  }
+
+  // the stage callback is called without mMutex and before the dependents are released,
+  // then the dependent stage's callback never precedes its prerequisite's.
+  void complete(size_t index, bool isSuccessfullyDone){
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      if( mNodes[index].state != NodeState::RUNNING ) return; // the completion is called twice
+      mRunningCounts[mNodes[index].pHal]--;
+      mNodes[index].state = isSuccessfullyDone ? NodeState::SUCCEEDED : NodeState::FAILED;
+    }
+    if( mStageCallback ){
+      mStageCallback(mNodes[index].id, mNodes[index].stage, isSuccessfullyDone);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mRemainingCount--;
+      for(auto dependent : mNodes[index].dependents){
+        if( !isSuccessfullyDone ){
+          fail(dependent);
+        } else if( !--mNodes[dependent].pendingCount ){
+          mReadyNodes.push_back(dependent);
+        }
+      }
+      dispatch();
+    }
+    mCondition.notify_all();
+  }
+
+  void execute(size_t index){
+    const std::string id = mNodes[index].id;
+    const Stage stage = mNodes[index].stage;
+    auto completion = [this, index](std::string id, bool isSuccessfullyDone){
+      complete(index, isSuccessfullyDone);
+    };
+    try{
+      switch( stage ){
+        case Stage::WRITE:
+          {
+            // the session's completion is the result such as the HAL's write failure or the digest mismatch.
+            // It might be posted to the completion executor.
+            auto pIsCompleted = std::make_shared<std::atomic<bool>>(false);
+            auto session = mHal->startUpdateSession(id, [this, index, pIsCompleted](std::string id, bool isSuccessfullyDone){
+              pIsCompleted->store(true);
+              complete(index, isSuccessfullyDone);
+            }, mTargets.at(id).type);
+            UpdateWritePipeline pipeline(mChunkSize, mBufferCount);
+            pipeline.run(session, mTargets.at(id).reader);
+            // the session isn't completed if the image is shorter than the session's size
+            auto pSessionImpl = std::dynamic_pointer_cast<UpdateSessionImpl>(session);
+            if( !( pSessionImpl ? pSessionImpl->isCompleted() : pIsCompleted->load() ) ){
+              complete(index, false);
+            }
+          }
+          break;
+        case Stage::VALIDATE:
+          mHal->validate(id, completion);
+          break;
+        case Stage::ACTIVATE:
+          mHal->activateForNext(id, completion);
+          break;
+        case Stage::RESTART:
+          mHal->restartAndWaitToBoot(id, completion);
+          break;
+      }
+    } catch (...) {
+      complete(index, false);
+    }
+  }
+
+public:
+  UpdateOrchestrator(
+    std::shared_ptr<UpdateInstallHalImpl> pHal,
+    size_t threadCount = std::thread::hardware_concurrency(),
+    int defaultConcurrencyPerHal = 1,
+    size_t chunkSize = 1024*1024,
+    size_t bufferCount = 4)
+    :
+    mHal(pHal),
+    mThreadCount(threadCount),
+    mDefaultConcurrency(defaultConcurrencyPerHal),
+    mChunkSize(chunkSize),
+    mBufferCount(bufferCount),
+    mRemainingCount(0)
+  {
+  }
+  virtual ~UpdateOrchestrator(){}
+
+  // the number of the stages running at once on the concrete HAL which handles the id
+  void setConcurrencyLimit(std::string id, int limit){
+    auto pHal = mHal->getConcreteHal(id);
+    if( !pHal ){
+      throw InvalidArgumentException( std::string("The id ") + id + " isn't supported" );
+    }
+    mConcurrencyLimits[pHal.get()] = std::max(1, limit);
+  }
+
+  // called on the worker threads. The callbacks of the independent stages might run concurrently,
+  // but the stage's callback returns before its dependent stages start.
+  void setStageCallback(STAGE_CALLBACK callback){
+    mStageCallback = callback;
+  }
+
+  // add the target written with the image by the reader
+  void addTarget(std::string id, UpdateWritePipeline::READER reader, bool isRestartRequired = false, IUpdateSession::UpdateType type = IUpdateSession::UpdateType::FULL){
+    auto pHal = mHal->getConcreteHal(id);
+    if( !pHal ){
+      throw InvalidArgumentException( std::string("The id ") + id + " isn't supported" );
+    }
+    if( mTargets.contains(id) ){
+      throw IllegalInvocationException( std::string("The id ") + id + " is already added" );
+    }
+    mTargets[id] = Target{ reader, type };
+    size_t write = addNode(id, Stage::WRITE, pHal.get());
+    size_t validate = addNode(id, Stage::VALIDATE, pHal.get());
+    size_t activate = addNode(id, Stage::ACTIVATE, pHal.get());
+    addEdge(write, validate);
+    addEdge(validate, activate);
+    if( isRestartRequired ){
+      addEdge(activate, addNode(id, Stage::RESTART, pHal.get()));
+    }
+  }
+
+  // the stage of the id runs after the dependsOnStage of dependsOnId succeeded
+  void addDependency(std::string id, Stage stage, std::string dependsOnId, Stage dependsOnStage){
+    addEdge( getNodeIndex(dependsOnId, dependsOnStage), getNodeIndex(id, stage) );
+  }
+
+  // run all of the targets and wait for the completion. Returns the result per target. This can be called once.
+  std::map<std::string, bool> run(){
+    if( hasCycle() ){
+      throw IllegalStateException("The dependency has a cycle");
+    }
+    mPool = std::make_shared<UpdateThreadPool>(mThreadCount);
+    {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mRemainingCount = mNodes.size();
+      for(size_t i = 0; i < mNodes.size(); i++){
+        if( !mNodes[i].pendingCount ){
+          mReadyNodes.push_back(i);
+        }
+      }
+      dispatch();
+      mCondition.wait(lock, [this](){ return !mRemainingCount; });
+    }
+    mPool.reset();
+
+    std::map<std::string, bool> result;
+    for(auto& node : mNodes){
+      result[node.id] = ( result.contains(node.id) ? result[node.id] : true ) && ( node.state == NodeState::SUCCEEDED );
+    }
+    return result;
+  }
+};
+
+
+class UpdateInstallHalFactory
+{
+protected:
+  static std::shared_ptr<IUpdateInstallHal> mInstance;
+
+public:
+  static std::shared_ptr<IUpdateInstallHal> getInstance();
+};
 
+#endif // __UPDATER_HPP__
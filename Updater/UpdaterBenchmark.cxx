@@ -0,0 +1,189 @@
+/*
+  Copyright (C) 2025 hidenorly
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// clang++ -std=c++20 -O2 UpdaterBenchmark.cxx -o updater_benchmark
+// ./updater_benchmark [directory] [totalSizeMB] [none|chunk|end] [direct|uring] [queueDepth]
+//   The total size is split to the concurrent partitions. The slot files are removed after each run.
+//   uring : ConcreteUpdateHalBlockDeviceImpl on the files. The sync policy "chunk" syncs every chunk and the others sync at the end.
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <ctime>
+
+#define USE_PLUGIN 0
+#include "UpdateFileHal.hpp"
+#include "UpdateBlockDeviceHal.hpp"
+
+
+struct BenchmarkResult
+{
+  double throughput;  // MB/s
+  double latencies[4];// p50, p90, p99, max [uSec]
+  double cpuTime;     // [Sec]
+  double wallTime;    // [Sec]
+  bool isDirectIo;
+  bool isValidated;
+};
+
+double getCpuTime()
+{
+  struct timespec time;
+  ::clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+typedef std::function<std::shared_ptr<IConcreteUpdateHal>(std::vector<std::string> ids, uint64_t imageSize)> HAL_FACTORY;
+
+BenchmarkResult runBenchmark(std::string directory, uint64_t totalSize, size_t chunkSize, int partitionCount, HAL_FACTORY createHal)
+{
+  const uint64_t imageSize = std::max<uint64_t>(chunkSize, totalSize / partitionCount / chunkSize * chunkSize);
+  std::vector<std::string> ids;
+  for(int i = 0; i < partitionCount; i++){
+    ids.push_back( std::string("benchmark_partition_") + std::to_string(i) );
+  }
+  auto pConcreteHal = createHal(ids, imageSize);
+  UpdateInstallHalImpl hal;
+  hal.registerConcreteHal(pConcreteHal);
+
+  std::vector<std::shared_ptr<IUpdateSession>> sessions;
+  for(auto& id : ids){
+    sessions.push_back( hal.startUpdateSession(id, [](std::string id, bool isSuccessfullyDone){}) );
+  }
+  std::vector<std::vector<double>> latencies(partitionCount);
+  std::vector<std::exception_ptr> errors(partitionCount);
+
+  const double cpuStartTime = getCpuTime();
+  auto startTime = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for(int i = 0; i < partitionCount; i++){
+    threads.push_back( std::thread([&, i](){
+      std::vector<uint8_t> chunk(chunkSize, (uint8_t)(i + 1));
+      try{
+        for(uint64_t writtenSize = 0; writtenSize < imageSize; writtenSize += chunkSize){
+          auto chunkStartTime = std::chrono::steady_clock::now();
+          sessions[i]->write(chunk);
+          latencies[i].push_back( std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - chunkStartTime).count() );
+        }
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    }) );
+  }
+  for(auto& thread : threads){
+    thread.join();
+  }
+  auto endTime = std::chrono::steady_clock::now();
+  const double cpuEndTime = getCpuTime();
+
+  BenchmarkResult result{};
+  if( auto pFileHal = std::dynamic_pointer_cast<ConcreteUpdateHalFileImpl>(pConcreteHal) ){
+    result.isDirectIo = pFileHal->isDirectIo(ids[0]);
+  } else if( auto pBlockDeviceHal = std::dynamic_pointer_cast<ConcreteUpdateHalBlockDeviceImpl>(pConcreteHal) ){
+    result.isDirectIo = pBlockDeviceHal->isDirectIo(ids[0]);
+  }
+  result.isValidated = true;
+  for(auto& id : ids){
+    hal.validate(id, [&](std::string id, bool isSuccessfullyDone){
+      result.isValidated = result.isValidated && isSuccessfullyDone;
+    });
+  }
+  sessions.clear();
+  pConcreteHal.reset();
+  for(auto& id : ids){
+    ::unlink( (directory + "/" + id + ".next").c_str() );
+    ::unlink( (directory + "/" + id + ".active").c_str() );
+  }
+  for(auto& error : errors){
+    if( error ) std::rethrow_exception(error);
+  }
+
+  std::vector<double> allLatencies;
+  for(auto& partitionLatencies : latencies){
+    allLatencies.insert(allLatencies.end(), partitionLatencies.begin(), partitionLatencies.end());
+  }
+  std::sort(allLatencies.begin(), allLatencies.end());
+  const double percentiles[] = {0.5, 0.9, 0.99, 1.0};
+  for(int i = 0; i < 4; i++){
+    result.latencies[i] = allLatencies.empty() ? 0 : allLatencies[ std::min(allLatencies.size() - 1, (size_t)(percentiles[i] * allLatencies.size())) ];
+  }
+  result.wallTime = std::chrono::duration<double>(endTime - startTime).count();
+  result.cpuTime = cpuEndTime - cpuStartTime;
+  result.throughput = imageSize * partitionCount / 1048576.0 / result.wallTime;
+  return result;
+}
+
+std::string getSizeString(size_t size)
+{
+  return ( size >= 1024*1024 ) ? std::to_string(size / 1024 / 1024) + "MB" : std::to_string(size / 1024) + "KB";
+}
+
+
+int main(int argc, char** argv)
+{
+  std::string directory = ( argc >= 2 ) ? argv[1] : ".";
+  uint64_t totalSize = ( ( argc >= 3 ) ? std::stoull(argv[2]) : 128 ) * 1024 * 1024;
+  std::string policy = ( argc >= 4 ) ? argv[3] : "end";
+  std::string backend = ( argc >= 5 ) ? argv[4] : "file";
+  uint32_t queueDepth = ( argc >= 6 ) ? std::stoul(argv[5]) : 8;
+  ConcreteUpdateHalFileImpl::SyncPolicy syncPolicy = ( policy == "none" ) ? ConcreteUpdateHalFileImpl::SyncPolicy::NONE :
+    ( policy == "chunk" ) ? ConcreteUpdateHalFileImpl::SyncPolicy::EVERY_CHUNK : ConcreteUpdateHalFileImpl::SyncPolicy::AT_END;
+
+  std::cout << "directory=" << directory << " total=" << getSizeString(totalSize) << " sync=" << policy << " backend=" << backend;
+  if( backend == "uring" ){
+    UpdateIoUring ring;
+    std::cout << " queueDepth=" << queueDepth << " io_uring=" << ring.open(queueDepth);
+  }
+  std::cout << std::endl;
+  std::cout << std::setw(6) << "chunk" << std::setw(6) << "parts" << std::setw(10) << "MB/s"
+    << std::setw(10) << "p50[uS]" << std::setw(10) << "p90[uS]" << std::setw(10) << "p99[uS]" << std::setw(10) << "max[uS]"
+    << std::setw(9) << "CPU[S]" << std::setw(7) << "CPU%" << std::setw(9) << "O_DIRECT" << std::endl;
+
+  try{
+    for(size_t chunkSize : {4*1024, 16*1024, 64*1024, 256*1024, 1024*1024, 4*1024*1024, 16*1024*1024}){
+      for(int partitionCount : {1, 2, 4, 8}){
+        BenchmarkResult result = runBenchmark(directory, totalSize, chunkSize, partitionCount, [&](std::vector<std::string> ids, uint64_t imageSize){
+          std::shared_ptr<IConcreteUpdateHal> result;
+          if( backend == "uring" ){
+            std::map<std::string, std::string> devicePaths;
+            for(auto& id : ids){
+              devicePaths[id] = directory + "/" + id + ".next";
+            }
+            uint64_t syncInterval = ( syncPolicy == ConcreteUpdateHalFileImpl::SyncPolicy::EVERY_CHUNK ) ? chunkSize : imageSize;
+            result = std::make_shared<ConcreteUpdateHalBlockDeviceImpl>(devicePaths, imageSize, queueDepth, 1024*1024, syncInterval);
+          } else {
+            result = std::make_shared<ConcreteUpdateHalFileImpl>(directory, ids, imageSize, syncPolicy, backend == "direct");
+          }
+          return result;
+        });
+        std::cout << std::fixed << std::setprecision(1);
+        std::cout << std::setw(6) << getSizeString(chunkSize) << std::setw(6) << partitionCount << std::setw(10) << result.throughput;
+        for(auto& latency : result.latencies){
+          std::cout << std::setw(10) << latency;
+        }
+        std::cout << std::setprecision(3) << std::setw(9) << result.cpuTime << std::setprecision(0) << std::setw(7) << ( result.cpuTime / result.wallTime * 100.0 );
+        std::cout << std::setw(9) << result.isDirectIo << ( result.isValidated ? "" : " (not validated)" ) << std::endl;
+      }
+    }
+  } catch (BaseException& ex){
+    ex.dump();
+    return 1;
+  }
+
+  return 0;
+}
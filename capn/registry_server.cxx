@@ -31,12 +31,12 @@
 #include <unistd.h>
 
 #include "registry.hpp"
+#include "../ShardedRegistry.hpp"
 
 class RegistryServer final : public Registry::Server, public MyInterface
 {
 protected:
-  std::map<std::string, std::string> mRegistry;
-  std::mutex mRegistryMutex;
+  ShardedRegistry mRegistry;
 
   std::unordered_map<uint32_t, Callback::Client> mCallbacks;
   std::mutex mRegisterMutex;
@@ -66,7 +66,7 @@ public:
   kj::Promise<void> set(SetContext context) override{
     auto key = context.getParams().getKey();
     auto value = context.getParams().getValue();
-    if( setValue(key, value) ){
+    if( mRegistry.set(std::string_view(key.cStr(), key.size()), std::string(value.cStr(), value.size())) ){
       // changed
       for( auto& [id, cb] : mCallbacks ){
         auto req = cb.onUpdateRequest();
@@ -87,7 +87,7 @@ public:
 
   kj::Promise<void> get(GetContext context) override {
     auto key = context.getParams().getKey();
-    auto value = getValue(key);
+    auto value = mRegistry.getOr(std::string_view(key.cStr(), key.size()));
     context.getResults().setReply(kj::StringPtr(value));//context.getResults().setReply(kj::StringPtr(value));//context.getResults().setReply(kj::str(value));
 
     std::cout << "get(key=" << key.cStr() << ") returns " << value << std::endl;
@@ -98,29 +98,11 @@ public:
 
 public:
   std::string getValue(std::string key) override {
-    std::lock_guard<std::mutex> lock(mRegistryMutex);
-
-    return mRegistry.contains(key) ? mRegistry[key] : "";
+    return mRegistry.getOr(key);
   }
 
   bool setValue(std::string key, std::string value) override {
-    std::lock_guard<std::mutex> lock(mRegistryMutex);
-
-    std::string oldValue;
-    bool valueChanged = false;
-
-    {
-      if (mRegistry.contains(key)) {
-        oldValue = mRegistry[key];
-      }
-      if (oldValue != value || !mRegistry.contains(key)) {
-        mRegistry[key] = value;
-        //std::cout << "key=" << key << ", value=" << value << std::endl;
-        valueChanged = true;
-      }
-    }
-
-    return valueChanged;
+    return mRegistry.set(key, std::move(value));
   }
 };
 
@@ -22,7 +22,10 @@
 #include <memory>
 #include <string>
 #include <thread>
+#include <atomic>
+#include <iomanip>
 #include <algorithm>
+#include <latch>
 #include "build/generated/example.grpc.pb.h"
 #include "GrpcUtil.hpp"
 #include "../../OptParse/OptParse.hpp"
@@ -39,6 +42,11 @@ using com::gmail::twitte::harold::ShutdownRequest;
 using com::gmail::twitte::harold::ShutdownReply;
 using com::gmail::twitte::harold::ChangeNotification;
 using com::gmail::twitte::harold::SubscriptionRequest;
+using com::gmail::twitte::harold::KeyValue;
+using com::gmail::twitte::harold::GetValuesRequest;
+using com::gmail::twitte::harold::GetValuesReply;
+using com::gmail::twitte::harold::SetValuesRequest;
+using com::gmail::twitte::harold::SetValuesReply;
 
 class MyServiceClient : public ClientBase<MyServiceClient, ExampleService> {
 public:
@@ -88,6 +96,56 @@ public:
         return status.ok();
     }
 
+    // the values in the order of the keys. "" if it's not found. empty if the RPC failed.
+    std::vector<std::string> getValues(const std::vector<std::string>& keys) {
+        GetValuesRequest request;
+        for (auto& key : keys) {
+            request.add_keys(key);
+        }
+
+        GetValuesReply reply;
+        ClientContext context;
+
+        Status status = getStub()->GetValues(&context, request, &reply);
+        return status.ok() ? std::vector<std::string>(reply.values().begin(), reply.values().end()) : std::vector<std::string>();
+    }
+
+    bool setValues(const std::vector<std::pair<std::string, std::string>>& entries) {
+        SetValuesRequest request;
+        for (auto& [key, value] : entries) {
+            KeyValue* pEntry = request.add_entries();
+            pEntry->set_key(key);
+            pEntry->set_value(value);
+        }
+
+        SetValuesReply reply;
+        ClientContext context;
+
+        Status status = getStub()->SetValues(&context, request, &reply);
+        return status.ok();
+    }
+
+    // the entries are streamed by batchSize entries per message
+    bool setStream(const std::vector<std::pair<std::string, std::string>>& entries, size_t batchSize) {
+        SetValuesReply reply;
+        ClientContext context;
+        std::unique_ptr<grpc::ClientWriter<SetValuesRequest>> writer(getStub()->SetStream(&context, &reply));
+
+        bool isWritten = true;
+        for (size_t i = 0; i < entries.size() && isWritten; i += batchSize) {
+            SetValuesRequest request;
+            for (size_t j = i; j < std::min(entries.size(), i + batchSize); j++) {
+                KeyValue* pEntry = request.add_entries();
+                pEntry->set_key(entries[j].first);
+                pEntry->set_value(entries[j].second);
+            }
+            isWritten = writer->Write(request);
+        }
+        writer->WritesDone();
+        Status status = writer->Finish();
+        return isWritten && status.ok();
+    }
+
     bool shutdown(void) {
         ShutdownRequest request;
         ShutdownReply reply;
@@ -122,6 +180,8 @@ protected:
         {
             std::lock_guard<std::mutex> lock(mMutexSubscriber);
             mSubscriberContext = std::make_unique<ClientContext>();
+            // the changes of a batch are received by one ChangeNotification
+            mSubscriberContext->AddMetadata("coalesced-changes", "1");
             mSubscriberStream = std::unique_ptr<grpc::ClientReaderWriter<SubscriptionRequest, ChangeNotification>>(mStub->SubscribeToChanges(mSubscriberContext.get()));
         }
 
@@ -131,7 +191,13 @@ protected:
         while (mSubscriberContext && mSubscriberStream->Read(&notification)) {
             std::lock_guard<std::mutex> lock(mCallbackMutex);
             for( auto& [id, callback] : mCallbacks ){
-                callback(notification.key(), notification.new_value());
+                if( notification.changes_size() ){
+                    for( auto& change : notification.changes() ){
+                        callback(change.key(), change.value());
+                    }
+                } else {
+                    callback(notification.key(), notification.new_value());
+                }
             }
         }
 
@@ -216,6 +282,7 @@ void benchmark_callback(MyServiceClient& client, int count = 1000)
     }
 
     std::this_thread::sleep_for(std::chrono::seconds(3));
+    client.unregisterCallback(id_1);
 
     Clock::duration total_latency = Clock::duration::zero();
     int64_t received_count = 0;
@@ -236,11 +303,109 @@ void benchmark_callback(MyServiceClient& client, int count = 1000)
 
 
 
+// the keys/sec of SetValues/GetValues/SetStream against the batch size. The batch size 1 of "unary" is by SetValue/GetValue.
+void benchmark_batch(MyServiceClient& client, int count = 1000)
+{
+    std::vector<std::pair<std::string, std::string>> entries;
+    std::vector<std::string> keys;
+    for( int i=0; i<count; i++ ){
+        keys.push_back( "batch_" + std::to_string(i) );
+        entries.push_back( {keys.back(), std::to_string(i)} );
+    }
+    auto getKeysPerSecond = [count](std::chrono::steady_clock::time_point startTime){
+        return (int)( count / std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count() );
+    };
+
+    std::cout << std::setw(8) << "batch" << std::setw(12) << "SetValues" << std::setw(12) << "GetValues" << std::setw(12) << "SetStream" << "  [keys/sec]" << std::endl;
+    auto startTime = std::chrono::steady_clock::now();
+    for( auto& [key, value] : entries ){
+        client.setValue(key, value);
+    }
+    int setKeysPerSecond = getKeysPerSecond(startTime);
+    startTime = std::chrono::steady_clock::now();
+    for( auto& key : keys ){
+        client.getValue(key);
+    }
+    std::cout << std::setw(8) << "unary" << std::setw(12) << setKeysPerSecond << std::setw(12) << getKeysPerSecond(startTime) << std::setw(12) << "-" << std::endl;
+
+    for( int batchSize : {1, 10, 100, 1000} ){
+        if( batchSize > count ) break;
+        // the values are changed in each pass then the notifications are also measured
+        for( auto& entry : entries ){
+            entry.second += "'";
+        }
+        startTime = std::chrono::steady_clock::now();
+        for( int i=0; i<count; i+=batchSize ){
+            client.setValues( std::vector<std::pair<std::string, std::string>>(entries.begin() + i, entries.begin() + std::min(count, i + batchSize)) );
+        }
+        setKeysPerSecond = getKeysPerSecond(startTime);
+
+        startTime = std::chrono::steady_clock::now();
+        for( int i=0; i<count; i+=batchSize ){
+            client.getValues( std::vector<std::string>(keys.begin() + i, keys.begin() + std::min(count, i + batchSize)) );
+        }
+        int getValuesKeysPerSecond = getKeysPerSecond(startTime);
+
+        for( auto& entry : entries ){
+            entry.second += "'";
+        }
+        startTime = std::chrono::steady_clock::now();
+        client.setStream(entries, batchSize);
+        std::cout << std::setw(8) << batchSize << std::setw(12) << setKeysPerSecond << std::setw(12) << getValuesKeysPerSecond << std::setw(12) << getKeysPerSecond(startTime) << std::endl;
+    }
+}
+
+// the calls/sec of getValue/setValue by the threads. Each thread has the own connection then the scaling by the server's engine and cores is shown.
+void benchmark_throughput(const std::string& server_address, int maxThreadCount, int count = 1000)
+{
+    std::vector<int> threadCounts;
+    for( int threadCount = 1; threadCount < maxThreadCount; threadCount *= 2 ){
+        threadCounts.push_back( threadCount );
+    }
+    threadCounts.push_back( maxThreadCount );
+
+    double baseThroughput = 0;
+    for( int threadCount : threadCounts ){
+        std::latch ready( threadCount + 1 );
+        std::atomic<int> failedCount = 0;
+        std::vector<std::thread> threads;
+        for( int i=0; i<threadCount; i++ ){
+            threads.push_back( std::thread([&, i]{
+                MyServiceClient client;
+                client.connect(server_address, true);
+                const std::string key = "bench_" + std::to_string(i);
+                client.setValue(key, "");
+                ready.arrive_and_wait();
+                for( int j=0; j<count; j++ ){
+                    bool isSuccess = ( j % 2 ) ? !client.getValue(key).starts_with("RPC failed") : client.setValue(key, std::to_string(j));
+                    if( !isSuccess ) failedCount++;
+                }
+            }) );
+        }
+        ready.arrive_and_wait();
+        auto startTime = std::chrono::steady_clock::now();
+        for( auto& thread : threads ){
+            thread.join();
+        }
+        auto endTime = std::chrono::steady_clock::now();
+
+        double throughput = threadCount * count / std::chrono::duration<double>(endTime - startTime).count();
+        if( !baseThroughput ){
+            baseThroughput = throughput;
+        }
+        std::cout << "throughput[calls/sec] threads=" << threadCount << " : " << (int)throughput << " (x" << std::fixed << std::setprecision(2) << throughput / baseThroughput << std::defaultfloat << ")";
+        std::cout << ( failedCount ? " failed=" + std::to_string(failedCount) : "" ) << std::endl;
+    }
+}
+
+
 // ---- main ----
 int main(int argc, char** argv) {
     std::vector<OptParse::OptParseItem> options;
 
     options.push_back( OptParse::OptParseItem("-b", "--benchmark", true, "0", "Specify benchmark count if benchmark"));
+    options.push_back( OptParse::OptParseItem("-a", "--address", true, "localhost:50051", "Specify the server address"));
+    options.push_back( OptParse::OptParseItem("-t", "--threads", true, "0", "Specify the max threads of the throughput benchmark (0: the number of the cores)"));
 
     OptParse optParser( argc, argv, options );
 
@@ -248,7 +413,11 @@ int main(int argc, char** argv) {
     bool isBenchmark = optParser.values.contains("-b") && ( benchCount!=0 );
     std::cout << "benchmark : " << benchCount << std::endl;
 
-    std::string server_address("localhost:50051");
+    std::string server_address = optParser.values["-a"];
+    int maxThreadCount = std::stoi( optParser.values["-t"] );
+    if( maxThreadCount <= 0 ){
+        maxThreadCount = std::max(1, (int)std::thread::hardware_concurrency());
+    }
     MyServiceClient client;
     client.connect(server_address);
 
@@ -256,6 +425,8 @@ int main(int argc, char** argv) {
         if( isBenchmark ){
             benchmark_invoke( client, benchCount );
             benchmark_callback( client, benchCount );
+            benchmark_batch( client, benchCount );
+            benchmark_throughput( server_address, maxThreadCount, benchCount );
         } else {
             auto callback = [&](const std::string& key, const std::string& value) {
                 std::cout << "Notified via callback: Key '" << key << "' = '" << value << "'" << std::endl;
@@ -274,6 +445,15 @@ int main(int argc, char** argv) {
                     std::cout << "Set failed" << std::endl;
                 }
 
+                std::cout << "Setting key2, key3 and key4 by a batch. key2 is superseded in the batch..." << std::endl;
+                client.setValues( {{"key2", "value2"}, {"key3", "value3"}, {"key2", "value2b"}, {"key4", "value4"}} );
+                auto values = client.getValues( {"key2", "key3", "key4", "key5"} );
+                std::cout << "Got values:";
+                for (auto& value : values) {
+                    std::cout << " '" << value << "'";
+                }
+                std::cout << std::endl;
+
                 std::cout << "Getting key1..." << std::endl;
                 std::string value = client.getValue("key1");
                 std::cout << "Got value: " << value << std::endl;
@@ -15,16 +15,21 @@
 */
 
 // cd build; cmake ..; make; ./ExampleServer
+// ./ExampleServer -e async -q 4 -t 8 -d 60
 
 #include <iostream>
 #include <memory>
 #include <string>
 #include <map>
+#include <unordered_map>
+#include <algorithm>
 #include <thread>
 
 #include "GrpcUtil.hpp"
 #include "build/generated/example.grpc.pb.h"
 #include "ExampleService.hpp"
+#include "../ShardedRegistry.hpp"
+#include "../../OptParse/OptParse.hpp"
 
 using grpc::Server;
 using grpc::ServerBuilder;
@@ -41,6 +46,11 @@ using com::gmail::twitte::harold::ShutdownRequest;
 using com::gmail::twitte::harold::ShutdownReply;
 using com::gmail::twitte::harold::ChangeNotification;
 using com::gmail::twitte::harold::SubscriptionRequest;
+using com::gmail::twitte::harold::KeyValue;
+using com::gmail::twitte::harold::GetValuesRequest;
+using com::gmail::twitte::harold::GetValuesReply;
+using com::gmail::twitte::harold::SetValuesRequest;
+using com::gmail::twitte::harold::SetValuesReply;
 
 
 using SubscriptionManager = TSubscriptionManager<
@@ -54,65 +64,174 @@ using SubscriptionManager = TSubscriptionManager<
 class MyService : public ServiceBase<MyService>, public MyInterface, public ExampleService::Service
 {
 protected:
+  // ASYNC : the unary methods are called via the completion queues and the streaming methods are still called by the sync engine
+  class AsyncService : public ExampleService::WithAsyncMethod_GetValue<ExampleService::WithAsyncMethod_SetValue<
+    ExampleService::WithAsyncMethod_GetValues<ExampleService::WithAsyncMethod_SetValues<ExampleService::Service>>>>
+  {
+  protected:
+    MyService& mService;
+
+  public:
+    AsyncService(MyService& service):mService(service){};
+    virtual ~AsyncService() = default;
+
+    Status SubscribeToChanges(ServerContext* context, grpc::ServerReaderWriter<ChangeNotification, SubscriptionRequest>* stream) override {
+      return mService.SubscribeToChanges(context, stream);
+    }
+
+    Status Shutdown(ServerContext* context, const ShutdownRequest* request, ShutdownReply* reply) override {
+      return mService.Shutdown(context, request, reply);
+    }
+
+    Status SetStream(ServerContext* context, grpc::ServerReader<SetValuesRequest>* reader, SetValuesReply* reply) override {
+      return mService.SetStream(context, reader, reply);
+    }
+  };
+
   std::unique_ptr<Server> mServer;
-  std::map<std::string, std::string> mRegistry;
-  std::mutex mRegistryMutex;
-  SubscriptionManager mSubscriptionManager;
+  ShardedRegistry mRegistry;
+  SubscriptionManager mSubscriptionManager;          // one ChangeNotification per key
+  SubscriptionManager mCoalescedSubscriptionManager; // the changes of a batch in one ChangeNotification. Opted in by the metadata
+  AsyncService mAsyncService;
+
+  virtual void onStartAsync(grpc::ServerCompletionQueue* pCompletionQueue) override {
+    TAsyncUnaryCall<AsyncService, GetValueRequest, GetValueReply>::create(&mAsyncService, &AsyncService::RequestGetValue, [this](ServerContext* context, const GetValueRequest* request, GetValueReply* reply){
+      return GetValue(context, request, reply);
+    }, pCompletionQueue);
+    TAsyncUnaryCall<AsyncService, SetValueRequest, SetValueReply>::create(&mAsyncService, &AsyncService::RequestSetValue, [this](ServerContext* context, const SetValueRequest* request, SetValueReply* reply){
+      return SetValue(context, request, reply);
+    }, pCompletionQueue);
+    TAsyncUnaryCall<AsyncService, GetValuesRequest, GetValuesReply>::create(&mAsyncService, &AsyncService::RequestGetValues, [this](ServerContext* context, const GetValuesRequest* request, GetValuesReply* reply){
+      return GetValues(context, request, reply);
+    }, pCompletionQueue);
+    TAsyncUnaryCall<AsyncService, SetValuesRequest, SetValuesReply>::create(&mAsyncService, &AsyncService::RequestSetValues, [this](ServerContext* context, const SetValuesRequest* request, SetValuesReply* reply){
+      return SetValues(context, request, reply);
+    }, pCompletionQueue);
+  }
 
 public:
-  MyService(){
-    mRegistry["ro.serialno"] = "dummy";
+  MyService():mAsyncService(*this){
+    mRegistry.set("ro.serialno", "dummy");
   }
   virtual ~MyService() = default;
 
+  virtual ::grpc::Service* getGrpcService() override {
+    if( mOptions.engine == Engine::ASYNC ){
+      return &mAsyncService;
+    }
+    return static_cast<ExampleService::Service*>(this);
+  }
+
 //protected:
   virtual std::string getValue(std::string key) override {
-    std::lock_guard<std::mutex> lock(mRegistryMutex);
-    return mRegistry.contains(key) ? mRegistry[key] : "";
+    return mRegistry.getOr(key);
   }
 
   virtual void setValue(std::string key, std::string value) override {
-    std::string oldValue;
-    bool valueChanged = false;
+    updateValue(key, std::move(value));
+  }
 
-    {
-      if (mRegistry.contains(key)) {
-        oldValue = mRegistry[key];
-      }
-      if (oldValue != value || !mRegistry.contains(key)) {
-        mRegistry[key] = value;
-        valueChanged = true;
-      }
-    }
-    if (valueChanged) {
+  // the key is looked up as it is without the copy such as the request's
+  void updateValue(std::string_view key, std::string value) {
+    if (mRegistry.set(key, value)) {
       ChangeNotification notice;
-      notice.set_key(key);
+      notice.set_key(std::string(key));
       notice.set_new_value(value);
       mSubscriptionManager.notifyAll(notice);
+      mCoalescedSubscriptionManager.notifyAll(notice);
     }
   }
 
+  // each shard is locked once for the batch. The changes are notified per key to the legacy subscribers
+  // and by one ChangeNotification to the subscribers which opted in the coalesced changes.
+  uint32_t updateValues(const SetValuesRequest& request) {
+    std::vector<std::pair<std::string_view, std::string>> entries;
+    entries.reserve(request.entries_size());
+    for (auto& entry : request.entries()) {
+      entries.emplace_back(entry.key(), entry.value());
+    }
+    std::vector<size_t> changedIndexes = mRegistry.setBatch(std::move(entries));
+    if (changedIndexes.empty()) return 0;
+
+    // the last entry of the key is the value in the registry then the superseded ones aren't notified
+    std::unordered_map<std::string_view, size_t> lastIndexes;
+    for (int i = 0; i < request.entries_size(); i++) {
+      lastIndexes[request.entries(i).key()] = i;
+    }
+    std::vector<size_t> noticeIndexes;
+    for (auto& index : changedIndexes) {
+      noticeIndexes.push_back(lastIndexes[request.entries(index).key()]);
+    }
+    std::sort(noticeIndexes.begin(), noticeIndexes.end());
+    noticeIndexes.erase(std::unique(noticeIndexes.begin(), noticeIndexes.end()), noticeIndexes.end());
+
+    ChangeNotification coalescedNotice;
+    for (auto& index : noticeIndexes) {
+      ChangeNotification notice;
+      notice.set_key(request.entries(index).key());
+      notice.set_new_value(request.entries(index).value());
+      mSubscriptionManager.notifyAll(notice);
+      if (noticeIndexes.size() == 1) {
+        mCoalescedSubscriptionManager.notifyAll(notice);
+      } else {
+        *coalescedNotice.add_changes() = request.entries(index);
+      }
+    }
+    if (coalescedNotice.changes_size()) {
+      mCoalescedSubscriptionManager.notifyAll(coalescedNotice);
+    }
+    return noticeIndexes.size();
+  }
+
 public:
   Status GetValue(ServerContext* context, const GetValueRequest* request, GetValueReply* reply) override {
-    reply->set_value( getValue(request->key()) );
+    reply->set_value( mRegistry.getOr(request->key()) );
     return Status::OK;
   }
 
   Status SetValue(ServerContext* context, const SetValueRequest* request, SetValueReply* reply) override {
-    setValue( request->key(), request->value() );
+    updateValue( request->key(), request->value() );
+    reply->set_success(true);
+    return Status::OK;
+  }
+
+  Status GetValues(ServerContext* context, const GetValuesRequest* request, GetValuesReply* reply) override {
+    std::vector<std::string_view> keys(request->keys().begin(), request->keys().end());
+    for (auto& value : mRegistry.getBatch(keys)) {
+      reply->add_values( value ? std::move(*value) : std::string() );
+    }
+    return Status::OK;
+  }
+
+  Status SetValues(ServerContext* context, const SetValuesRequest* request, SetValuesReply* reply) override {
+    reply->set_changed_count( updateValues(*request) );
+    reply->set_success(true);
+    return Status::OK;
+  }
+
+  Status SetStream(ServerContext* context, grpc::ServerReader<SetValuesRequest>* reader, SetValuesReply* reply) override {
+    uint32_t changedCount = 0;
+    SetValuesRequest request;
+    while (reader->Read(&request)) {
+      changedCount += updateValues(request);
+    }
+    reply->set_changed_count(changedCount);
     reply->set_success(true);
     return Status::OK;
   }
 
   Status SubscribeToChanges(ServerContext* context, grpc::ServerReaderWriter<ChangeNotification, SubscriptionRequest>* stream) override {
-    mSubscriptionManager.addSubscription(context, stream);
-    std::cout << "Client subscribed to changes." << std::endl;
+    auto it = context->client_metadata().find("coalesced-changes");
+    const bool isCoalesced = ( it != context->client_metadata().end() ) && ( it->second == "1" );
+    SubscriptionManager& subscriptionManager = isCoalesced ? mCoalescedSubscriptionManager : mSubscriptionManager;
+    subscriptionManager.addSubscription(context, stream);
+    std::cout << "Client subscribed to changes." << ( isCoalesced ? " (coalesced)" : "" ) << std::endl;
 
     SubscriptionRequest request;
     while (stream->Read(&request)) {
     }
 
-    mSubscriptionManager.removeSubscription(context);
+    subscriptionManager.removeSubscription(context);
     std::cout << "Client unsubscribed from changes." << std::endl;
     return Status::OK;
   }
@@ -126,9 +245,28 @@ public:
   }
 };
 
-int main()
+int main(int argc, char** argv)
 {
+  std::vector<OptParse::OptParseItem> options;
+  options.push_back( OptParse::OptParseItem("-a", "--address", true, "0.0.0.0:50051", "Specify the listening address"));
+  options.push_back( OptParse::OptParseItem("-e", "--engine", true, "sync", "Specify the engine sync or async"));
+  options.push_back( OptParse::OptParseItem("-q", "--cqs", true, "0", "Specify the number of the completion queues (0: the number of the cores). Clamped to -t on async"));
+  options.push_back( OptParse::OptParseItem("-t", "--threads", true, "0", "Specify the number of the threads (0: the number of the cores)"));
+  options.push_back( OptParse::OptParseItem("-m", "--maxMessageSize", true, "-1", "Specify the max send/receive message size in bytes (-1: gRPC's default)"));
+  options.push_back( OptParse::OptParseItem("-d", "--duration", true, "10", "Specify the seconds to enable the server"));
+
+  OptParse optParser( argc, argv, options );
+
+  MyService::ServerOptions serverOptions;
+  serverOptions.address = optParser.values["-a"];
+  serverOptions.engine = ( optParser.values["-e"] == "async" ) ? MyService::Engine::ASYNC : MyService::Engine::SYNC;
+  serverOptions.completionQueueCount = std::stoi( optParser.values["-q"] );
+  serverOptions.threadCount = std::stoi( optParser.values["-t"] );
+  serverOptions.maxReceiveMessageSize = serverOptions.maxSendMessageSize = std::stoi( optParser.values["-m"] );
+  const int duration = std::stoi( optParser.values["-d"] );
+
   MyService service;
+  service.setServerOptions( serverOptions );
   std::cout << "Enable gRPC server\n";
   service.setEnabled(true);
   if( service.getEnabled() ){
@@ -144,9 +282,9 @@ int main()
   }
 
 
-  std::cout << "Enable sever in 10 seconds or invoke Shutdon() to turn off immediately\n";
+  std::cout << "Enable sever in " << duration << " seconds or invoke Shutdon() to turn off immediately\n";
   const int MIN_RESPONSE_MILLISECOND = 100;
-  for(int i=0; i<10*(1000/MIN_RESPONSE_MILLISECOND); i++){
+  for(int i=0; i<duration*(1000/MIN_RESPONSE_MILLISECOND); i++){
     std::this_thread::sleep_for(std::chrono::milliseconds(MIN_RESPONSE_MILLISECOND));
     if( !service.getEnabled() ) break;
   }
@@ -18,9 +18,16 @@
 #include <memory>
 #include <string>
 #include <map>
+#include <list>
+#include <vector>
+#include <mutex>
+#include <atomic>
 #include <thread>
+#include <functional>
+#include <algorithm>
 
 #include <grpcpp/grpcpp.h>
+#include <grpcpp/support/async_unary_call.h>
 
 using grpc::Server;
 using grpc::ServerBuilder;
@@ -29,12 +36,91 @@ using grpc::Status;
 
 // --- for server
 
+// the tag on the completion queue of the async engine
+class IAsyncCall
+{
+public:
+  virtual ~IAsyncCall() = default;
+  // ok is false if the call is cancelled such as by the server's shutdown
+  virtual void proceed(bool ok) = 0;
+};
+
+// TService: the service which has the async method such as ExampleService::WithAsyncMethod_GetValue<>
+// TRequest, TReply: the messages of the unary method
+template <typename TService, typename TRequest, typename TReply>
+class TAsyncUnaryCall : public IAsyncCall
+{
+public:
+  using REQUEST_METHOD = void (TService::*)(ServerContext*, TRequest*, grpc::ServerAsyncResponseWriter<TReply>*, grpc::CompletionQueue*, grpc::ServerCompletionQueue*, void*);
+  using HANDLER = std::function<Status(ServerContext*, const TRequest*, TReply*)>;
+
+protected:
+  TService* mService;
+  REQUEST_METHOD mRequestMethod;
+  HANDLER mHandler;
+  grpc::ServerCompletionQueue* mCompletionQueue;
+  ServerContext mContext;
+  TRequest mRequest;
+  grpc::ServerAsyncResponseWriter<TReply> mResponder;
+  bool mIsReplied;
+
+  TAsyncUnaryCall(TService* service, REQUEST_METHOD requestMethod, HANDLER handler, grpc::ServerCompletionQueue* pCompletionQueue):mService(service), mRequestMethod(requestMethod), mHandler(handler), mCompletionQueue(pCompletionQueue), mResponder(&mContext), mIsReplied(false){
+    (mService->*mRequestMethod)(&mContext, &mRequest, &mResponder, mCompletionQueue, mCompletionQueue, this);
+  }
+
+public:
+  // wait for the call of the method on the completion queue. The instance is deleted after the reply.
+  static void create(TService* service, REQUEST_METHOD requestMethod, HANDLER handler, grpc::ServerCompletionQueue* pCompletionQueue){
+    new TAsyncUnaryCall(service, requestMethod, handler, pCompletionQueue);
+  }
+
+  virtual void proceed(bool ok){
+    if( !ok || mIsReplied ){
+      delete this;
+      return;
+    }
+    // wait for the next call before handling this then the other threads of the completion queue can take it
+    create(mService, mRequestMethod, mHandler, mCompletionQueue);
+    TReply reply;
+    Status status = mHandler(&mContext, &mRequest, &reply);
+    mIsReplied = true;
+    mResponder.Finish(reply, status, this);
+  }
+};
+
 template <typename Derived>
 class ServiceBase
 {
+public:
+  enum class Engine
+  {
+    SYNC,   // gRPC's thread pool calls the sync methods
+    ASYNC,  // the threads of ServiceBase drive the completion queues. The derived class requests the async methods by onStartAsync()
+  };
+
+  struct ServerOptions
+  {
+    std::string address = "0.0.0.0:50051";
+    Engine engine = Engine::SYNC;
+    int completionQueueCount = 0;   // 0: the number of the cores. Clamped to threadCount on ASYNC since each queue needs its own thread to be drained
+    int threadCount = 0;            // the threads over the completion queues on ASYNC, the max pollers on SYNC. 0: the number of the cores
+    int maxReceiveMessageSize = -1; // -1: gRPC's default
+    int maxSendMessageSize = -1;    // -1: gRPC's default
+  };
+
 protected:
   std::atomic<bool> mIsEnabled = false;
   std::unique_ptr<Server> mServer;
+  ServerOptions mOptions;
+  std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> mCompletionQueues;
+  std::vector<std::thread> mThreads;
+
+  static int getCountOrCores(int count){
+    return ( count > 0 ) ? count : std::max(1, (int)std::thread::hardware_concurrency());
+  }
+
+  // ASYNC : request the async methods on the completion queue. This is called for each completion queue after the server is started.
+  virtual void onStartAsync(grpc::ServerCompletionQueue* pCompletionQueue){};
 
 public:
   ServiceBase() = default;
@@ -48,25 +134,81 @@ public:
       }).detach();
   }
 
+  // this is applied at the next setEnabled(true)
+  void setServerOptions(const ServerOptions& options){
+    mOptions = options;
+  }
+
+  ServerOptions getServerOptions(){
+    return mOptions;
+  }
+
   virtual void setEnabled(bool enabled) {
     if(!mIsEnabled && enabled){
       // enabling
-      std::string server_address("0.0.0.0:50051");
+      const int threadCount = getCountOrCores(mOptions.threadCount);
+      int completionQueueCount = getCountOrCores(mOptions.completionQueueCount);
+      if( mOptions.engine == Engine::ASYNC && completionQueueCount > threadCount ){
+        std::cerr << "The completion queues are clamped to the threads : " << completionQueueCount << " -> " << threadCount << std::endl;
+        completionQueueCount = threadCount;
+      }
 
       ServerBuilder builder;
-      builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+      builder.AddListeningPort(mOptions.address, grpc::InsecureServerCredentials());
+      if( mOptions.maxReceiveMessageSize >= 0 ){
+        builder.SetMaxReceiveMessageSize(mOptions.maxReceiveMessageSize);
+      }
+      if( mOptions.maxSendMessageSize >= 0 ){
+        builder.SetMaxSendMessageSize(mOptions.maxSendMessageSize);
+      }
       builder.RegisterService(getGrpcService());
+      if( mOptions.engine == Engine::ASYNC ){
+        for(int i = 0; i < completionQueueCount; i++){
+          mCompletionQueues.push_back( builder.AddCompletionQueue() );
+        }
+      } else {
+        builder.SetSyncServerOption(ServerBuilder::SyncServerOption::NUM_CQS, completionQueueCount);
+        builder.SetSyncServerOption(ServerBuilder::SyncServerOption::MAX_POLLERS, threadCount);
+      }
 
       mServer = builder.BuildAndStart();
-      std::cout << "Server listening on " << server_address << std::endl;
+      if( !mServer ){
+        std::cerr << "Failed to start server on " << mOptions.address << std::endl;
+        mCompletionQueues.clear();
+        return;
+      }
+      std::cout << "Server listening on " << mOptions.address << ( mOptions.engine == Engine::ASYNC ? " (async" : " (sync" ) << " engine, completion queues=" << completionQueueCount << ", threads=" << threadCount << ")" << std::endl;
 
-      // Run in the thread
-      std::thread([this]() {
-          mServer->Wait();
-      }).detach();
+      if( mOptions.engine == Engine::ASYNC ){
+        for(auto& pCompletionQueue : mCompletionQueues){
+          onStartAsync(pCompletionQueue.get());
+        }
+        for(int i = 0; i < threadCount; i++){
+          mThreads.push_back( std::thread([pCompletionQueue = mCompletionQueues[i % completionQueueCount].get()]() {
+            void* tag = nullptr;
+            bool ok = false;
+            while( pCompletionQueue->Next(&tag, &ok) ){
+              static_cast<IAsyncCall*>(tag)->proceed(ok);
+            }
+          }) );
+        }
+      } else {
+        // Run in the thread
+        std::thread([this]() {
+            mServer->Wait();
+        }).detach();
+      }
     } else if ( mIsEnabled && !enabled ){
-      // disabling
+      // disabling : the completion queues are drained after the server's shutdown
       mServer->Shutdown();
+      for(auto& pCompletionQueue : mCompletionQueues){
+        pCompletionQueue->Shutdown();
+      }
+      for(auto& thread : mThreads){
+        thread.join();
+      }
+      mThreads.clear();
+      mCompletionQueues.clear();
       mServer = nullptr;
     }
     mIsEnabled = enabled;
@@ -124,8 +266,15 @@ public:
     ClientBase() = default;
     virtual ~ClientBase() = default;
 
-    void connect(const std::string& server_address) {
-        mChannel = grpc::CreateChannel(server_address, grpc::InsecureChannelCredentials());
+    // isDedicated: the own connection which isn't shared with the other channels to the same server such as for the benchmark
+    void connect(const std::string& server_address, bool isDedicated = false) {
+        if (isDedicated) {
+            grpc::ChannelArguments args;
+            args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+            mChannel = grpc::CreateCustomChannel(server_address, grpc::InsecureChannelCredentials(), args);
+        } else {
+            mChannel = grpc::CreateChannel(server_address, grpc::InsecureChannelCredentials());
+        }
         mStub = ServiceType::NewStub(mChannel);
     }
 